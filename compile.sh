@@ -1,2 +1,2 @@
 #!/bin/sh
-fd -e vert -e frag -e geom -e glsl . shaders/ -x glslc {} -o {}.spv
+fd -e vert -e frag -e geom -e glsl . shaders/ -x glslc --target-env=vulkan1.2 {} -o {}.spv
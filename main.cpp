@@ -1,9 +1,16 @@
 #include <cstddef>
+#include <limits>
+#include <sys/resource.h>
+#include <thread>
 #include <fmt.h>
 #include <Transform.h>
 #include "FrameCounter.h"
 #include "render_engine/ForwardRenderer.h"
 #include "vlk/WindowRenderTarget.h"
+#include "vlk/OffscreenRenderTarget.h"
+#include "vlk/FrameReadback.h"
+
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
 constexpr auto unlitMaterialBindings = std::to_array({
     vk::DescriptorSetLayoutBinding {
@@ -15,25 +22,182 @@ constexpr auto unlitMaterialBindings = std::to_array({
     },
 });
 
-int main() {
-    glfwInit();
-    const vk::UniqueInstance instance = createInstance();
-    const WindowSurface window = createWindowSurface(instance.get());
-    const GraphicsContext graphicsContext = makeGraphicsContext(instance.get(), window.surface.get());
+int main(int argc, char** argv) {
+    const std::vector<std::string_view> args(argv + 1, argv + argc);
+    const auto hasArg = [&args](std::string_view arg) { return std::ranges::find(args, arg) != args.end(); };
+    const auto argValue = [&args](std::string_view arg) -> std::optional<std::string_view> {
+        const auto it = std::ranges::find(args, arg);
+        if (it == args.end() || std::next(it) == args.end()) { return std::nullopt; }
+        return *std::next(it);
+    };
+    const auto argInt = [&argValue](std::string_view arg, int defaultValue) {
+        const auto value = argValue(arg);
+        return value ? std::stoi(std::string(*value)) : defaultValue;
+    };
+
+    // --headless N renders N frames offscreen, without a windowing system
+    const std::optional<int> headlessFrames = hasArg("--headless") ? std::optional(argInt("--headless", 0)) : std::nullopt;
+    // --batch K renders K views per headless frame, each into its own image, in one submit
+    const uint32_t batchSize = headlessFrames ? std::max(argInt("--batch", 1), 1) : 1;
+    if (!headlessFrames) { glfwInit(); }
+    const vk::UniqueInstance instance = createInstance(!headlessFrames);
+    const std::optional<WindowSurface> window = headlessFrames ? std::nullopt : std::optional(createWindowSurface(instance.get()));
+    const GraphicsContext graphicsContext = makeGraphicsContext(instance.get(), window ? window->surface.get() : nullptr, {
+        .allowZeroCopyUploads = !hasArg("--staging-uploads"),
+    });
     const GraphicsContext* vlk = &graphicsContext;
+    const bool printMemoryStats = hasArg("--memory-stats");
+    const bool benchmarkRecording = hasArg("--bench-recording");
+    const uint32_t framesInFlight = argInt("--frames-in-flight", 2);
+    // --present-mode fifo|fifo-relaxed|mailbox|immediate
+    const vk::PresentModeKHR presentMode = [mode = argValue("--present-mode").value_or("fifo")] {
+        if (mode == "fifo-relaxed") { return vk::PresentModeKHR::eFifoRelaxed; }
+        if (mode == "mailbox") { return vk::PresentModeKHR::eMailbox; }
+        if (mode == "immediate") { return vk::PresentModeKHR::eImmediate; }
+        return vk::PresentModeKHR::eFifo;
+    }();
+    const bool lowLatency = hasArg("--low-latency");
+    // --msaa 1|2|4|8, --depth-format d16|d24|d32
+    const ForwardRendererOptions rendererOptions = {
+        .sampleCount = static_cast<vk::SampleCountFlagBits>(std::bit_floor((uint32_t) std::max(argInt("--msaa", 4), 1))),
+        .depthFormat = [format = argValue("--depth-format").value_or("d32")] {
+            if (format == "d16") { return vk::Format::eD16Unorm; }
+            if (format == "d24") { return vk::Format::eX8D24UnormPack32; }
+            return vk::Format::eD32Sfloat;
+        }(),
+        // --dynamic-resolution MS scales rendering between 50% and 100% to keep GPU frame time at MS
+        .dynamicResolution = hasArg("--dynamic-resolution")
+            ? std::optional(DynamicResolutionOptions { .targetGpuTime = (double) argInt("--dynamic-resolution", 14) })
+            : std::nullopt,
+        // --record-threads N records large views into secondary command buffers on N threads
+        .recordingThreads = (uint32_t) std::max(argInt("--record-threads", 1), 1),
+        // --vertex-pulling fetches vertices in the vertex shader instead of binding vertex buffers
+        .vertexPulling = hasArg("--vertex-pulling"),
+    };
     AssetPool assets;
-    WindowRenderTarget renderTarget (vlk, &window);
-    ForwardRenderer renderer (vlk);
-    renderer.setRenderTarget(renderTarget.renderTarget());
-    renderTarget.onRecreateSwapchain = [&]() { renderer.updateRenderTarget(renderTarget.renderTarget()); };
+    GeometryPool geometry(vlk, objVertexLayout);
+    std::optional<WindowRenderTarget> windowTarget;
+    std::optional<OffscreenRenderTarget> offscreenTarget;
+    ForwardRenderer renderer (vlk, rendererOptions);
+    if (window) {
+        windowTarget.emplace(vlk, &*window, framesInFlight, presentMode);
+        windowTarget->pacer.enabled = lowLatency;
+        renderer.setRenderTarget(windowTarget->renderTarget());
+        windowTarget->onRecreateSwapchain = [&]() { renderer.updateRenderTarget(windowTarget->renderTarget()); };
+    } else {
+        offscreenTarget.emplace(vlk, vk::Extent2D {800, 600}, vk::Format::eB8G8R8A8Srgb, framesInFlight, batchSize);
+        renderer.setRenderTarget(offscreenTarget->renderTarget());
+    }
+    const auto startFrame = [&] { return windowTarget ? windowTarget->startFrame() : offscreenTarget->startFrame(); };
+    const auto endFrame = [&] { return windowTarget ? windowTarget->endFrame() : offscreenTarget->endFrame(); };
+    const FramePacer& pacer = windowTarget ? windowTarget->pacer : offscreenTarget->pacer;
+
+    FrameCounter frameCounter;
 
+    // --capture DIR writes every --capture-every N-th frame to DIR/frame_<n>.ppm from a worker thread
+    std::optional<FrameReadback> readback;
+    if (const auto captureDir = argValue("--capture")) {
+        const auto writePpm = [dir = std::string(*captureDir)](const FrameReadback::CapturedFrame& f) {
+            std::ofstream file(fmt_raw(dir, "/frame_", f.frame, ".ppm"), std::ios::binary);
+            file << "P6\n" << f.extent.width << " " << f.extent.height << "\n255\n";
+            const bool bgra = f.format == vk::Format::eB8G8R8A8Srgb || f.format == vk::Format::eB8G8R8A8Unorm;
+            std::vector<char> rgb(f.pixels.size() / 4 * 3);
+            for (size_t i = 0; i < f.pixels.size() / 4; i++) {
+                const auto* px = &f.pixels[i * 4];
+                rgb[i * 3 + 0] = (char) px[bgra ? 2 : 0];
+                rgb[i * 3 + 1] = (char) px[1];
+                rgb[i * 3 + 2] = (char) px[bgra ? 0 : 2];
+            }
+            file.write(rgb.data(), rgb.size());
+        };
+        readback.emplace(vlk, framesInFlight * batchSize + 1, writePpm);
+        renderer.onFrameRendered = [&, every = (size_t) std::max(argInt("--capture-every", 1), 1)](vk::CommandBuffer commandBuffer, const Frame& frame, vk::Image image) {
+            if (frameCounter.frameCount() % every == 0) {
+                // Batched views of a frame get consecutive numbers
+                const auto& target = renderer.getRenderTarget();
+                const size_t view = std::ranges::find(target.images, image) - target.images.begin() - frame.imageIndex;
+                (void) readback->record(commandBuffer, frameCounter.frameCount() * batchSize + view, image, target);
+            }
+        };
+    }
+
+    Stopwatch loadTimer;
     const auto unlitMaterial = makeMaterialType(vlk, unlitMaterialBindings);
     renderer.registerMaterialType(unlitMaterial.descriptorPool.descriptorSetLayout.get());
 
-    const auto bricksTexture = makeTexture(vlk, assets, "textures/bricks.png", vk::Format::eR8G8B8A8Srgb);
-    const auto bricksUnlitMaterial = unlitMaterial.makeMaterial(std::span(&bricksTexture, 1));
+    auto bricksTexture = makeTexture(vlk, assets, "textures/bricks.png", vk::Format::eR8G8B8A8Srgb);
+    auto bricksUnlitMaterial = unlitMaterial.makeMaterial(std::span(&bricksTexture, 1));
+    auto whiteTexture = makeTexture(vlk, assets, "textures/white.png", vk::Format::eR8G8B8A8Srgb);
+    auto whiteUnlitMaterial = unlitMaterial.makeMaterial(std::span(&whiteTexture, 1));
+
+    const auto cubeMesh = makeMesh(geometry, "models/cube.obj");
+    assets.onRelocateImage = [&](vk::Image from, vk::Image to) {
+        relocateTexture(vlk, assets, bricksTexture, from, to);
+        relocateTexture(vlk, assets, whiteTexture, from, to);
+        unlitMaterial.updateMaterial(bricksUnlitMaterial, std::span(&bricksTexture, 1));
+        unlitMaterial.updateMaterial(whiteUnlitMaterial, std::span(&whiteTexture, 1));
+    };
+    const UploadTicket assetsUploaded = vlk->uploads->flush(); // Runs on the GPU while the first frames are recorded
+    auto reportLoadTime = [&, reported = false]() mutable {
+        if (reported || !vlk->uploads->isComplete(assetsUploaded)) { return; }
+        reported = true;
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        prn_raw("Assets loaded in ", loadTimer.ping(), " ms using ", vlk->props.zeroCopyUploads ? "zero-copy" : "staging",
+                " uploads, peak RSS ", usage.ru_maxrss, " KiB");
+    };
 
-    const auto cubeMesh = makeMesh(vlk, assets, "models/cube.obj");
+    vlk->allocator->printStats();
+
+    // --bench-allocations N makes the same N device-local allocations through DeviceAllocator and through one vkAllocateMemory each,
+    // all live at once, then frees them. Reports allocations per second and peak device memory of both
+    if (hasArg("--bench-allocations")) {
+        const auto& limits = vlk->props.deviceProperties.limits;
+        // Leaves room under maxMemoryAllocationCount for what is already allocated
+        const auto count = std::min<size_t>(std::max(argInt("--bench-allocations", 2000), 1), limits.maxMemoryAllocationCount / 2);
+        constexpr auto sizes = std::to_array<vk::DeviceSize>({4 << 10, 16 << 10, 64 << 10, 16 << 10});
+        const auto requirements = [&](size_t i) {
+            return vk::MemoryRequirements {
+                .size = sizes[i % sizes.size()],
+                .alignment = 256,
+                .memoryTypeBits = ~0u,
+            };
+        };
+        const auto perSecond = [count](double ms) { return fmt_raw((size_t) (count * 1000 / ms), " allocations/s"); };
+
+        DeviceAllocator allocator(vlk->physicalDevice, vlk->device.get(), false);
+        std::vector<DeviceAllocation> allocations;
+        allocations.reserve(count);
+        Stopwatch st;
+        for (size_t i = 0; i < count; i++) {
+            allocations.push_back(allocator.allocate(requirements(i), vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryCategory::mesh));
+        }
+        allocations.clear();
+        const double suballocatedTime = st.ping();
+        const auto suballocated = allocator.stats();
+
+        const uint32_t memoryType = allocator.findMemoryType(~0u, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        std::vector<vk::UniqueDeviceMemory> memories;
+        memories.reserve(count);
+        vk::DeviceSize dedicatedBytes = 0;
+        st.ping();
+        for (size_t i = 0; i < count; i++) {
+            const auto size = requirements(i).size;
+            memories.push_back(vlk->device->allocateMemoryUnique({
+                .allocationSize = size,
+                .memoryTypeIndex = memoryType,
+            }));
+            dedicatedBytes += size;
+        }
+        memories.clear();
+        const double dedicatedTime = st.ping();
+
+        prn_raw("Allocation benchmark, ", count, " allocations:");
+        prn_raw("\tDeviceAllocator: ", perSecond(suballocatedTime), ", ", suballocated.deviceAllocationCalls, " vkAllocateMemory calls, peak ",
+                suballocated.peakAllocatedBytes >> 10, " KiB");
+        prn_raw("\tvkAllocateMemory per resource: ", perSecond(dedicatedTime), ", ", count, " vkAllocateMemory calls, peak ",
+                dedicatedBytes >> 10, " KiB");
+    }
 
     std::vector<Transform> cubes;
     for (size_t i = 0; i < 10; i++) {
@@ -49,30 +213,109 @@ int main() {
         .rotation = Quaternion::Euler(0, 0, std::numbers::pi),
     };
 
-    FrameCounter frameCounter;
-    while (!glfwWindowShouldClose(window.window.get())) {
-        glfwPollEvents();
-        if (const auto frame = renderTarget.startFrame()) {
+    // Simulation: everything drawn this frame
+    const auto buildPacket = [&](RenderPacket& packet) {
+        for (uint32_t v = 0; v < batchSize; v++) {
+            // Views of a batch look at the scene from different angles
+            Transform viewCamera = camera;
+            viewCamera.rotation = Quaternion::Euler(0, 0, std::numbers::pi + 0.1 * v);
+            packet.views.push_back({.view = Transform::z_convert * viewCamera.Matrix().Inverse()});
+        }
+        // Alternating materials, the worst case for state changes in submission order
+        for (size_t i = 0; i < cubes.size(); i++) {
+            packet.draws.push_back({
+                .mesh = &cubeMesh,
+                .material = i % 2 ? &whiteUnlitMaterial : &bricksUnlitMaterial,
+                .model = cubes[i].Matrix(),
+            });
+        }
+    };
+
+    // Rendering: records and submits one frame
+    const auto renderFrame = [&](const RenderPacket& packet) {
+        reportLoadTime();
+        if (printMemoryStats) { vlk->allocator->printStats(); }
+        renderer.updateResolutionScale(pacer.metrics().gpuTime);
+        if (const auto frame = startFrame()) {
+            assets.compact(vlk, 8 << 20);
             renderer.startFrame(*frame);
-            for (const auto& transform : cubes) {
-                const Matrix4 model = transform.Matrix();
-                const Matrix4 view = Transform::z_convert * camera.Matrix().Inverse();
-                const float aspect = (float) renderer.getRenderTarget().extent.width / renderer.getRenderTarget().extent.height;
-                const Matrix4 proj = Transform::PerspectiveProjection(90, aspect, {0.1, 500}) * Transform::y_flip;
-                // const Matrix4 proj = Transform::OrthgraphicProjection(2, aspect, {0.1, 10}) * Transform::y_flip;
-                const Matrix4 mvp = (proj * view * model).Transposed();
-                renderer.draw(cubeMesh, bricksUnlitMaterial, mvp);
+            renderer.drawPacket(packet);
+            if (benchmarkRecording && frameCounter.frameCount() == 0) {
+                // Device functions from vkGetDeviceProcAddr against the loader's trampolines
+                const VULKAN_HPP_DEFAULT_DISPATCHER_TYPE trampolines(instance.get(), VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr);
+                constexpr size_t nDraws = 50000;
+                const Matrix4 mvp = (renderer.viewProjection(packet.views.front()) * cubes.front().Matrix()).Transposed();
+                double direct = std::numeric_limits<double>::max();
+                double trampolined = std::numeric_limits<double>::max();
+                for (size_t i = 0; i < 3; i++) {
+                    direct = std::min(direct, renderer.benchmarkRecording(cubeMesh, bricksUnlitMaterial, mvp, nDraws, VULKAN_HPP_DEFAULT_DISPATCHER));
+                    trampolined = std::min(trampolined, renderer.benchmarkRecording(cubeMesh, bricksUnlitMaterial, mvp, nDraws, trampolines));
+                }
+                prn_raw("Recorded ", nDraws, " draws in ", direct, " ms with device-level dispatch, ", trampolined, " ms through the loader (",
+                        (trampolined - direct) * 1e6 / nDraws, " ns saved per draw)");
             }
             renderer.endFrame();
-            renderTarget.endFrame();
+            const uint64_t submitted = endFrame();
+            if (readback) { readback->submitted(submitted); }
         }
         frameCounter.tick();
-        if (frameCounter.frameCount() == 0) {
-            prn_raw(frameCounter.frameTimeTotal(), " s total, ", frameCounter.frameTimeAvg(), " ms avg (", frameCounter.fpsAvg(), " fps)");
-            break;
+    };
+
+    // --render-thread records and submits on a separate thread, while this one builds the next packet.
+    // The render thread owns the renderer, render target, assets and frame counter until it is joined.
+    if (hasArg("--render-thread")) {
+        if (lowLatency) { prn("--low-latency paces the single-threaded loop only, ignored with --render-thread"); }
+        RenderPacketQueue<2> packets;
+        std::thread renderThread([&] {
+            while (const RenderPacket* packet = packets.acquire()) {
+                renderFrame(*packet);
+                packets.release();
+            }
+        });
+        for (size_t built = 0; headlessFrames ? built < (size_t) *headlessFrames : !glfwWindowShouldClose(window->window.get()); built++) {
+            if (!headlessFrames) {
+                glfwPollEvents();
+                windowTarget->updateFramebufferSize();
+            }
+            buildPacket(packets.beginWrite());
+            packets.publish();
+        }
+        packets.close();
+        renderThread.join();
+    } else {
+        const auto keepRunning = [&] {
+            if (headlessFrames) { return frameCounter.frameCount() < (size_t) *headlessFrames; }
+            windowTarget->pacer.wait();
+            glfwPollEvents();
+            windowTarget->updateFramebufferSize();
+            return !glfwWindowShouldClose(window->window.get());
+        };
+        RenderPacket packet;
+        while (keepRunning()) {
+            packet.clear();
+            buildPacket(packet);
+            renderFrame(packet);
+            if (frameCounter.frameCount() == 0) {
+                prn_raw(frameCounter.frameTimeTotal(), " s total, ", frameCounter.frameTimeAvg(), " ms avg (", frameCounter.fpsAvg(), " fps)");
+                break;
+            }
         }
     }
     vlk->device->waitIdle();
+    if (readback) {
+        readback->flush();
+        prn_raw("Captured frames dropped: ", readback->dropped());
+    }
+    vlk->deletionQueue->clear(); // Before descriptor pools and other owners are destroyed
+    if (headlessFrames) {
+        prn_raw(frameCounter.frameCount(), " frames in ", frameCounter.frameTimeTotal(), " ms, ", frameCounter.frameTimeAvg(), " ms avg (", frameCounter.fpsAvg(), " fps)");
+        prn_raw(batchSize, " views per frame, ", frameCounter.fpsAvg() * batchSize, " images/s");
+    }
+    pacer.printMetrics();
+    renderer.printBindStats();
+    if (rendererOptions.dynamicResolution) {
+        prn_raw("Resolution scale: ", renderer.resolutionScale());
+    }
 }
 
 // void applySystem(const auto& fn, auto&... objectRanges) {
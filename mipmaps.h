@@ -0,0 +1,62 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace mipmaps {
+
+    namespace detail {
+        inline const std::array<float, 256>& srgb_to_linear_table() {
+            static const auto table = [] {
+                std::array<float, 256> ret;
+                for (size_t i = 0; i < ret.size(); i++) {
+                    const float c = i / 255.0f;
+                    ret[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return ret;
+            }();
+            return table;
+        }
+
+        inline uint8_t linear_to_srgb(float c) {
+            const float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+            return static_cast<uint8_t>(std::clamp(s * 255.0f + 0.5f, 0.0f, 255.0f));
+        }
+    }
+
+    /// 2x2 box filter of an 8 bit per channel image, odd edges are clamped.
+    /// With srgb set color channels are averaged in linear space, alpha (4th channel) never is.
+    inline std::vector<uint8_t> downsample(std::span<const uint8_t> src, size_t w, size_t h, size_t channels, bool srgb) {
+        const size_t dw = std::max<size_t>(w / 2, 1);
+        const size_t dh = std::max<size_t>(h / 2, 1);
+        const auto& to_linear = detail::srgb_to_linear_table();
+        std::vector<uint8_t> ret(dw * dh * channels);
+        for (size_t y = 0; y < dh; y++) {
+            const size_t y0 = std::min(2 * y, h - 1);
+            const size_t y1 = std::min(2 * y + 1, h - 1);
+            for (size_t x = 0; x < dw; x++) {
+                const size_t x0 = std::min(2 * x, w - 1);
+                const size_t x1 = std::min(2 * x + 1, w - 1);
+                const auto texels = std::to_array({
+                    &src[(y0 * w + x0) * channels],
+                    &src[(y0 * w + x1) * channels],
+                    &src[(y1 * w + x0) * channels],
+                    &src[(y1 * w + x1) * channels],
+                });
+                for (size_t c = 0; c < channels; c++) {
+                    const bool linear = !srgb || c == 3;
+                    float sum = 0;
+                    for (const auto* t : texels) { sum += linear ? t[c] : to_linear[t[c]]; }
+                    ret[(y * dw + x) * channels + c] = linear
+                        ? static_cast<uint8_t>(sum / 4 + 0.5f)
+                        : detail::linear_to_srgb(sum / 4);
+                }
+            }
+        }
+        return ret;
+    }
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "vlk/GraphicsContext.h"
+
+struct DynamicResolutionOptions {
+    // Fractions of the render target's extent, per axis
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    double targetGpuTime = 14.0; // ms
+};
+
+// Picks a resolution scale that keeps the GPU frame time at the target.
+// Fill cost is proportional to the pixel count, so the scale moves by the square root of the time ratio.
+class DynamicResolution {
+    DynamicResolutionOptions options;
+    float scale_;
+
+public:
+    explicit DynamicResolution(const DynamicResolutionOptions& options) : options(options), scale_(options.maxScale) {
+        assert(options.minScale > 0 && options.minScale <= options.maxScale);
+    }
+
+    const DynamicResolutionOptions& getOptions() const { return options; }
+    float scale() const { return scale_; }
+
+    // Called once per frame with a (smoothed) GPU frame time, 0 if unknown
+    void update(double gpuTime) {
+        if (gpuTime <= 0) { return; }
+        const float ideal = scale_ * std::sqrt(options.targetGpuTime / gpuTime);
+        // Dead band against noise, and partial steps since gpuTime lags behind the scale
+        if (std::abs(ideal - scale_) < scale_ * 0.02f) { return; }
+        scale_ = std::clamp(scale_ + (ideal - scale_) * 0.25f, options.minScale, options.maxScale);
+    }
+
+    static vk::Extent2D scaled(vk::Extent2D extent, float scale) {
+        return {
+            .width = std::max(1u, (uint32_t) std::lround(extent.width * scale)),
+            .height = std::max(1u, (uint32_t) std::lround(extent.height * scale)),
+        };
+    }
+};
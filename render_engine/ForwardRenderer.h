@@ -1,31 +1,65 @@
 #pragma once
 #include "Matrix.h"
+#include "Transform.h"
+#include <Stopwatch.h>
 #include "vlk/GraphicsContext.h"
 #include "vlk/ImageAttachment.h"
+#include "vlk/MappedBuffer.h"
 #include "vlk/utils.h"
 #include "vlk/utils.h"
 #include "Mesh.h"
 #include "Material.h"
+#include "DynamicResolution.h"
+#include "RenderPacket.h"
+#include "RenderQueue.h"
+#include "WorkerPool.h"
+
+// Per-instance vertex data (binding 1), one entry per drawn object
+struct InstanceData {
+    Matrix4 mvp; // Transposed, GLSL reads columns
+};
+
+// Vertex shader push constants with vertex pulling, see shaders/triangle_pulling.vert
+struct VertexPullingConstants {
+    vk::DeviceAddress vertices;  // Mesh::vertexAddress
+    vk::DeviceAddress instances; // InstanceData array
+    // Mesh::layout in 4-byte words
+    uint32_t stride;
+    uint32_t positionOffset;
+    uint32_t uvOffset;
+    constexpr bool operator==(const VertexPullingConstants&) const = default;
+};
 
 // TODO too specific
+// vertexPulling: no vertex input state, the shader reads vertices and instances through VertexPullingConstants,
+// so meshes of any VertexLayout share the pipeline
 inline vk::UniquePipeline makeGraphicsPipeline(
     const GraphicsContext* vlk,
     vk::PipelineLayout pipelineLayout,
     vk::RenderPass renderPass,
-    uint32_t subpass
+    uint32_t subpass,
+    vk::SampleCountFlagBits sampleCount,
+    bool vertexPulling = false
 ) {
-    const auto vertShader = vlk->createShaderModule("shaders/triangle.vert.spv");
+    const auto vertShader = vlk->createShaderModule(vertexPulling ? "shaders/triangle_pulling.vert.spv" : "shaders/triangle.vert.spv");
     const auto fragShader = vlk->createShaderModule("shaders/triangle.frag.spv");
     struct Vertex {
         Vector3 pos;
         Vector2 uv;
         constexpr bool operator==(const Vertex&) const = default;
     };
-    static constexpr vk::VertexInputBindingDescription bindingDescription = {
-        .binding = 0,
-        .stride = sizeof(Vertex),
-        .inputRate = vk::VertexInputRate::eVertex,
-    };
+    static constexpr auto bindingDescriptions = std::to_array({
+        vk::VertexInputBindingDescription {
+            .binding = 0,
+            .stride = sizeof(Vertex),
+            .inputRate = vk::VertexInputRate::eVertex,
+        },
+        vk::VertexInputBindingDescription {
+            .binding = 1,
+            .stride = sizeof(InstanceData),
+            .inputRate = vk::VertexInputRate::eInstance,
+        },
+    });
     static constexpr auto attributeDescriptions = std::to_array({
         vk::VertexInputAttributeDescription {
             .location = 0,
@@ -39,6 +73,31 @@ inline vk::UniquePipeline makeGraphicsPipeline(
             .format = vk::Format::eR32G32Sfloat,
             .offset = offsetof(Vertex, uv),
         },
+        // A mat4 takes one location per column
+        vk::VertexInputAttributeDescription {
+            .location = 2,
+            .binding = 1,
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .offset = offsetof(InstanceData, mvp),
+        },
+        vk::VertexInputAttributeDescription {
+            .location = 3,
+            .binding = 1,
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .offset = offsetof(InstanceData, mvp) + sizeof(float) * 4,
+        },
+        vk::VertexInputAttributeDescription {
+            .location = 4,
+            .binding = 1,
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .offset = offsetof(InstanceData, mvp) + sizeof(float) * 8,
+        },
+        vk::VertexInputAttributeDescription {
+            .location = 5,
+            .binding = 1,
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .offset = offsetof(InstanceData, mvp) + sizeof(float) * 12,
+        },
     });
     const auto shaderStages = std::to_array({
         vlk->genShaderStageCreateInfo(vk::ShaderStageFlagBits::eVertex, vertShader),
@@ -46,9 +105,9 @@ inline vk::UniquePipeline makeGraphicsPipeline(
     });
     vk::PipelineVertexInputStateCreateInfo vertexInputState = {
         .flags = {},
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDescription,
-        .vertexAttributeDescriptionCount = (uint32_t) attributeDescriptions.size(),
+        .vertexBindingDescriptionCount = vertexPulling ? 0 : (uint32_t) bindingDescriptions.size(),
+        .pVertexBindingDescriptions = bindingDescriptions.data(),
+        .vertexAttributeDescriptionCount = vertexPulling ? 0 : (uint32_t) attributeDescriptions.size(),
         .pVertexAttributeDescriptions = attributeDescriptions.data(),
     };
     vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState = {
@@ -76,10 +135,9 @@ inline vk::UniquePipeline makeGraphicsPipeline(
         .depthBiasSlopeFactor = 0,
         .lineWidth = 1,
     };
-    // TODO maxSampleCount
     vk::PipelineMultisampleStateCreateInfo multisampleState = {
         .flags = {},
-        .rasterizationSamples = vlk->props.maxSampleCount,
+        .rasterizationSamples = sampleCount,
         .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 1,
         .pSampleMask = nullptr,
@@ -147,24 +205,142 @@ inline vk::UniquePipeline makeGraphicsPipeline(
     return vlk->device->createGraphicsPipelineUnique(nullptr, pipelineInfo).value;
 }
 
+struct ForwardRendererOptions {
+    // Clamped to what the device supports, e1 renders straight into the render target without resolving
+    vk::SampleCountFlagBits sampleCount = vk::SampleCountFlagBits::e4;
+    // eD16Unorm, eX8D24UnormPack32 or eD32Sfloat, falls back to another one when unsupported
+    vk::Format depthFormat = vk::Format::eD32Sfloat;
+    // Renders into internal attachments at a varying fraction of the target's extent and upscales them into it
+    std::optional<DynamicResolutionOptions> dynamicResolution = std::nullopt;
+    // Threads recording queued draws into secondary command buffers, including the calling thread. 1 records inline
+    uint32_t recordingThreads = 1;
+    // Vertices and instances are read by the vertex shader through buffer device addresses, nothing is bound as a vertex buffer.
+    // Falls back to vertex input bindings without bufferDeviceAddress
+    bool vertexPulling = false;
+};
+
 class ForwardRenderer {
     const GraphicsContext* vlk;
 
     RenderTarget renderTarget;
 
     vk::SampleCountFlagBits sampleCount;
+    vk::Format depthFormat;
+    std::optional<DynamicResolution> dynamicResolution;
     vk::UniqueRenderPass renderPass;
     struct FramebufferResources {
-        ImageAttachment colorAttachment;
+        vk::Extent2D attachmentExtent = {}; // At least renderTarget.extent, only that sub-rect is rendered
+        vk::Format attachmentFormat = {};
+        ImageAttachment colorAttachment; // Only with multisampling
         ImageAttachment depthAttachment;
-        std::vector<vk::UniqueFramebuffer> framebuffers;
+        ImageAttachment sceneColor;      // Only with dynamic resolution, upscaled into the render target
+        std::vector<vk::UniqueFramebuffer> framebuffers; // One per render target image, a single one with dynamic resolution
     } swapchainResources;
+    Frame currentFrame;
+    uint32_t currentView;
+    vk::Extent2D renderExtent; // Of the current frame
+    bool vertexPulling;
 
     struct RegisteredMaterialType {
         vk::UniquePipelineLayout pipelineLayout;
         vk::UniquePipeline pipeline;
+        uint32_t id; // For sort keys
     };
     std::map<vk::DescriptorSetLayout, RegisteredMaterialType> registeredMaterials;
+    uint32_t nextMaterialTypeId = 0;
+
+    // Draws collected during a view, sorted by SortKey when the view ends and recorded as one instanced draw per mesh and material
+    struct QueuedDraw {
+        Mesh mesh;
+        Material material;
+        const RegisteredMaterialType* materialType;
+        InstanceData instance;
+
+        // Everything a draw binds, draws with equal state are merged
+        auto state() const {
+            return std::tuple(
+                materialType->pipeline.get(), material.descriptorSet,
+                mesh.vertexBuffer, mesh.indexBuffer, mesh.vertexOffset, mesh.firstIndex, mesh.nIndices, mesh.nVertices
+            );
+        }
+    };
+    std::vector<QueuedDraw> queuedDraws;
+    RenderQueue renderQueue;
+    DenseIds<vk::DescriptorSet> materialIds;
+    DenseIds<uint64_t> meshIds; // By offsets, meshes in different GeometryPool blocks may share ids
+    struct DrawGroup {
+        uint32_t first; // Index into the sorted RenderQueue entries
+        uint32_t count;
+    };
+    std::vector<DrawGroup> drawGroups;
+
+    // Parallel recording: the sorted draw groups are split into one contiguous chunk per thread.
+    // Each chunk is recorded into a secondary command buffer from its own pool, one set of pools per frame in flight
+    std::unique_ptr<WorkerPool> workers;
+    struct RecordingPool {
+        vk::UniqueCommandPool commandPool;
+        std::vector<vk::UniqueCommandBuffer> commandBuffers;
+        uint32_t used = 0; // This frame, one per view
+    };
+    std::vector<std::vector<RecordingPool>> recordingPools; // [Frame::frameIndex][chunk]
+    static constexpr uint32_t minGroupsPerChunk = 256; // Below this a wake-up costs more than it saves
+    bool renderPassBegun = false; // For the current view
+
+    // benchmarkRecording() records into this and resets it, it is never submitted
+    vk::UniqueCommandPool scratchCommandPool;
+    vk::UniqueCommandBuffer scratchCommandBuffer;
+
+public:
+    // State changes recorded, summed over frames
+    struct BindCounts {
+        uint64_t pipelines = 0;
+        uint64_t descriptorSets = 0;
+        uint64_t vertexBuffers = 0;
+        uint64_t indexBuffers = 0;
+        uint64_t instanceBuffers = 0;
+        uint64_t pushConstants = 0; // Vertex pulling constants
+        uint64_t draws = 0;
+    };
+
+private:
+    BindCounts submittedBinds; // What recording each draw in submission order would have cost
+    // Bound while recording the queued draws one by one in submission order, into the frame's command buffer
+    struct SubmittedState {
+        vk::Pipeline pipeline = nullptr;
+        vk::DescriptorSet descriptorSet = nullptr;
+        vk::Buffer vertexBuffer = nullptr;
+        vk::Buffer indexBuffer = nullptr;
+        vk::Buffer instanceBuffer = nullptr;
+        VertexPullingConstants pullingConstants = {};
+    } submittedState;
+    BindCounts recordedBinds;
+    uint64_t recordedFrames = 0;
+
+    // Host-visible, written while recording. One per frame in flight, reused once the render target waited for its frame
+    struct InstanceBuffer {
+        MappedBuffer buffer;
+        vk::DeviceAddress address = 0;
+        uint32_t capacity = 0; // In instances
+    };
+    std::vector<InstanceBuffer> instanceBuffers; // Indexed by Frame::frameIndex
+    uint32_t usedInstances = 0; // In the current frame's buffer
+    struct InstanceRange {
+        vk::Buffer buffer;
+        vk::DeviceAddress address; // Of buffer, only with vertex pulling
+        uint32_t first;
+        InstanceData* data;
+    };
+
+    // Push constants of a vertex pulling draw of mesh with its instances in `instances`
+    static VertexPullingConstants pullingConstants(const Mesh& mesh, const InstanceRange& instances) {
+        return {
+            .vertices = mesh.vertexAddress,
+            .instances = instances.address,
+            .stride = mesh.layout.stride / 4,
+            .positionOffset = mesh.layout.positionOffset / 4,
+            .uvOffset = mesh.layout.uvOffset / 4,
+        };
+    }
 
 private:
     class CommandRecorder {
@@ -187,15 +363,43 @@ private:
         LazyUpdate<vk::Buffer> lastIndexBuffer;
         LazyUpdate<vk::Pipeline> lastPipeline;
         LazyUpdate<vk::DescriptorSet> lastMaterialDescriptorSet;
+        LazyUpdate<vk::Buffer> lastInstanceBuffer;
+        bool vertexPulling;
+        LazyUpdate<VertexPullingConstants> lastPullingConstants;
 
     public:
-        explicit CommandRecorder(vk::CommandBuffer commandBuffer = nullptr) : commandBuffer(commandBuffer) {}
+        BindCounts counts;
+
+        explicit CommandRecorder(vk::CommandBuffer commandBuffer = nullptr, bool vertexPulling = false)
+            : commandBuffer(commandBuffer), vertexPulling(vertexPulling) {}
 
-        void start(vk::RenderPass renderPass, vk::Framebuffer framebuffer, vk::Extent2D imageExtent) {
+        void begin() {
             commandBuffer.begin({
                 .flags = {},
                 .pInheritanceInfo = nullptr,
             });
+        }
+
+        // Secondary command buffer continuing subpass 0 of a render pass
+        void beginSecondary(vk::RenderPass renderPass, vk::Framebuffer framebuffer, vk::Extent2D imageExtent) {
+            const vk::CommandBufferInheritanceInfo inheritance = {
+                .renderPass = renderPass,
+                .subpass = 0,
+                .framebuffer = framebuffer,
+                .occlusionQueryEnable = VK_FALSE,
+                .queryFlags = {},
+                .pipelineStatistics = {},
+            };
+            commandBuffer.begin({
+                .flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+                .pInheritanceInfo = &inheritance,
+            });
+            // Dynamic state isn't inherited
+            setViewport(imageExtent);
+        }
+
+        // With eSecondaryCommandBuffers contents only executeCommands() may follow, until endRenderPass()
+        void beginRenderPass(vk::RenderPass renderPass, vk::Framebuffer framebuffer, vk::Extent2D imageExtent, vk::SubpassContents contents = vk::SubpassContents::eInline) {
             constexpr auto clearValues = std::to_array({
                 vk::ClearValue {
                     .color = {
@@ -217,7 +421,13 @@ private:
                 },
                 .clearValueCount = (uint32_t) clearValues.size(),
                 .pClearValues = clearValues.data(),
-            }, vk::SubpassContents::eInline);
+            }, contents);
+            if (contents == vk::SubpassContents::eInline) {
+                setViewport(imageExtent);
+            }
+        }
+
+        void setViewport(vk::Extent2D imageExtent) {
             commandBuffer.setViewport(0, vk::Viewport {
                 .x = 0,
                 .y = 0,
@@ -232,29 +442,65 @@ private:
             });
         }
 
-        void draw(const Mesh& mesh, vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, const Material& material, const Matrix4& mvp) {
-            if (lastVertexBuffer.update(mesh.vertexBuffer)) {
-                commandBuffer.bindVertexBuffers(0, {mesh.vertexBuffer}, {0});
+        // Draws `count` instances of `mesh`, their InstanceData starting at `first` in `instances`
+        template <typename Dispatch = VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>
+        void draw(
+            const Mesh& mesh, vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, const Material& material,
+            const InstanceRange& instances, uint32_t first, uint32_t count, const Dispatch& d = VULKAN_HPP_DEFAULT_DISPATCHER
+        ) {
+            if (!vertexPulling && lastVertexBuffer.update(mesh.vertexBuffer)) {
+                commandBuffer.bindVertexBuffers(0, {mesh.vertexBuffer}, {0}, d);
+                counts.vertexBuffers++;
             }
             if (mesh.indexed && lastIndexBuffer.update(mesh.indexBuffer)) {
-                commandBuffer.bindIndexBuffer(mesh.indexBuffer, 0, vk::IndexType::eUint32);
+                commandBuffer.bindIndexBuffer(mesh.indexBuffer, 0, vk::IndexType::eUint32, d);
+                counts.indexBuffers++;
             }
             if (lastPipeline.update(pipeline)) {
-                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline, d);
+                counts.pipelines++;
             }
             if (lastMaterialDescriptorSet.update(material.descriptorSet)) {
-                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, material.descriptorSet, nullptr);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, material.descriptorSet, nullptr, d);
+                counts.descriptorSets++;
             }
-            commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Matrix4), &mvp);
+            counts.draws++;
+            if (vertexPulling) {
+                // Every material type's layout has the same push constant range, so the values survive pipeline changes.
+                // Meshes of a GeometryPool block share the address, only the layout words differ between pools
+                const auto constants = pullingConstants(mesh, instances);
+                if (lastPullingConstants.update(constants)) {
+                    commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(constants), &constants, d);
+                    counts.pushConstants++;
+                }
+            } else if (lastInstanceBuffer.update(instances.buffer)) {
+                commandBuffer.bindVertexBuffers(1, {instances.buffer}, {0}, d);
+                counts.instanceBuffers++;
+            }
+            const uint32_t firstInstance = instances.first + first;
             if (mesh.indexed) {
-                commandBuffer.drawIndexed(mesh.nIndices, 1, 0, 0, 0);
+                commandBuffer.drawIndexed(mesh.nIndices, count, mesh.firstIndex, mesh.vertexOffset, firstInstance, d);
             } else {
-                commandBuffer.draw(mesh.nVertices, 1, 0, 0);
+                commandBuffer.draw(mesh.nVertices, count, mesh.vertexOffset, firstInstance, d);
             }
         }
 
-        void end() {
+        void executeCommands(std::span<const vk::CommandBuffer> secondaryCommandBuffers) {
+            commandBuffer.executeCommands(secondaryCommandBuffers);
+            // Bound state is undefined afterwards
+            lastVertexBuffer = LazyUpdate<vk::Buffer>();
+            lastIndexBuffer = LazyUpdate<vk::Buffer>();
+            lastPipeline = LazyUpdate<vk::Pipeline>();
+            lastMaterialDescriptorSet = LazyUpdate<vk::DescriptorSet>();
+            lastInstanceBuffer = LazyUpdate<vk::Buffer>();
+            lastPullingConstants = LazyUpdate<VertexPullingConstants>();
+        }
+
+        void endRenderPass() {
             commandBuffer.endRenderPass();
+        }
+
+        void end() {
             commandBuffer.end();
         }
     };
@@ -262,6 +508,9 @@ private:
     CommandRecorder commandRecorder;
 
 private:
+    bool multisampled() const { return sampleCount != vk::SampleCountFlagBits::e1; }
+    bool upscaled() const { return dynamicResolution.has_value(); }
+
     void createRenderPass() {
         vk::AttachmentDescription colorAttachmentDesc = {
             .flags = {},
@@ -276,7 +525,7 @@ private:
         };
         vk::AttachmentDescription depthAttachmentDesc = {
             .flags = {},
-            .format = vk::Format::eD32Sfloat,
+            .format = depthFormat,
             .samples = sampleCount,
             .loadOp = vk::AttachmentLoadOp::eClear,
             .storeOp = vk::AttachmentStoreOp::eDontCare,
@@ -294,8 +543,14 @@ private:
             .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
             .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
             .initialLayout = vk::ImageLayout::eUndefined,
-            .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+            // The upscaling blit reads sceneColor
+            .finalLayout = upscaled() ? vk::ImageLayout::eTransferSrcOptimal : renderTarget.finalLayout,
         };
+        if (!multisampled()) {
+            // The render target (or sceneColor) is the color attachment
+            colorAttachmentDesc.storeOp = vk::AttachmentStoreOp::eStore;
+            colorAttachmentDesc.finalLayout = colorResolveDesc.finalLayout;
+        }
         vk::AttachmentReference colorAttachmentRef = {
             .attachment = 0,
             .layout = vk::ImageLayout::eColorAttachmentOptimal,
@@ -315,7 +570,7 @@ private:
             .pInputAttachments = nullptr,
             .colorAttachmentCount = 1,
             .pColorAttachments = &colorAttachmentRef,
-            .pResolveAttachments = &colorResolveRef,
+            .pResolveAttachments = multisampled() ? &colorResolveRef : nullptr,
             .pDepthStencilAttachment = &depthAttachmentRef,
             .preserveAttachmentCount = 0,
             .pPreserveAttachments = nullptr,
@@ -324,93 +579,233 @@ private:
         vk::SubpassDependency extenralDependency = {
             .srcSubpass = VK_SUBPASS_EXTERNAL,
             .dstSubpass = 0,
-            .srcStageMask = stage::eColorAttachmentOutput | stage::eEarlyFragmentTests | stage::eLateFragmentTests,
+            .srcStageMask = stage::eColorAttachmentOutput | stage::eEarlyFragmentTests | stage::eLateFragmentTests | stage::eTransfer,
             .dstStageMask = stage::eColorAttachmentOutput | stage::eEarlyFragmentTests | stage::eLateFragmentTests,
-            .srcAccessMask = vk::AccessFlagBits::eNone,
+            // Attachments are shared by all frames in flight, the previous frame's writes must finish first,
+            // as must the previous upscaling blit reading sceneColor
+            .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
             .dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
             .dependencyFlags = {},
         };
-        const auto attachmentDescriptions = std::to_array({colorAttachmentDesc, depthAttachmentDesc, colorResolveDesc});
+        // The upscaling blit or a readback copies the resolved image once the finalLayout transition is done.
+        // The implicit dependency would only order that transition before bottom-of-pipe
+        vk::SubpassDependency outgoingDependency = {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = stage::eColorAttachmentOutput,
+            .dstStageMask = stage::eTransfer,
+            .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+            .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+            .dependencyFlags = {},
+        };
+        const auto dependencies = std::to_array({extenralDependency, outgoingDependency});
+        const auto attachmentDescriptions = multisampled()
+            ? std::vector({colorAttachmentDesc, depthAttachmentDesc, colorResolveDesc})
+            : std::vector({colorAttachmentDesc, depthAttachmentDesc});
         vk::RenderPassCreateInfo createInfo = {
             .flags = {},
-            .attachmentCount = attachmentDescriptions.size(),
+            .attachmentCount = (uint32_t) attachmentDescriptions.size(),
             .pAttachments = attachmentDescriptions.data(),
             .subpassCount = 1,
             .pSubpasses = &subpass,
-            .dependencyCount = 1,
-            .pDependencies = &extenralDependency,
+            .dependencyCount = (uint32_t) dependencies.size(),
+            .pDependencies = dependencies.data(),
         };
         renderPass = vlk->device->createRenderPassUnique(createInfo);
     }
 
-    void createSwapchainResources() {
-        // TODO should be lazy allocated
-        swapchainResources.colorAttachment = makeImageAttachment(vlk, {
-            .flags = {},
-            .imageType = vk::ImageType::e2D,
-            .format = renderTarget.format,
-            .extent = {
-                renderTarget.extent.width,
-                renderTarget.extent.height,
-                1
-            },
-            .mipLevels = 1,
-            .arrayLayers = 1,
-            .samples = sampleCount,
-            .tiling = vk::ImageTiling::eOptimal,
-            .usage = vk::ImageUsageFlagBits::eColorAttachment,
-            .sharingMode = vk::SharingMode::eExclusive,
-            .queueFamilyIndexCount = 0,
-            .pQueueFamilyIndices = nullptr,
-            .initialLayout = vk::ImageLayout::eUndefined,
-        }, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eColor);
+    // Attachments are kept while the render target fits into them, so a drag-resize doesn't reallocate every frame.
+    // When it outgrows them they are allocated with headroom.
+    // They never leave the tile on tilers, so they are transient and lazily allocated where possible.
+    void createAttachments() {
+        const auto& current = swapchainResources.attachmentExtent;
+        // With dynamic resolution allocated for the largest scale, so scaling never reallocates
+        const auto target = upscaled() ? DynamicResolution::scaled(renderTarget.extent, dynamicResolution->getOptions().maxScale) : renderTarget.extent;
+        const bool fits = target.width <= current.width && target.height <= current.height;
+        const bool wasteful = 4ull * target.width * target.height < 1ull * current.width * current.height;
+        if (fits && !wasteful && swapchainResources.attachmentFormat == renderTarget.format) { return; }
+        const auto& limits = vlk->props.deviceProperties.limits;
+        const vk::Extent2D extent = {
+            .width = std::min(target.width + target.width / 4, limits.maxFramebufferWidth),
+            .height = std::min(target.height + target.height / 4, limits.maxFramebufferHeight),
+        };
+        // Frames still in flight may be rendering into the old attachments
+        vlk->deletionQueue->push(std::move(swapchainResources.colorAttachment));
+        vlk->deletionQueue->push(std::move(swapchainResources.depthAttachment));
+        vlk->deletionQueue->push(std::move(swapchainResources.sceneColor));
+        swapchainResources.attachmentExtent = extent;
+        swapchainResources.attachmentFormat = renderTarget.format;
+        using mem = vk::MemoryPropertyFlagBits;
+        const vk::MemoryPropertyFlags memoryProperties = vlk->props.lazilyAllocatedMemory ? mem::eDeviceLocal | mem::eLazilyAllocated : mem::eDeviceLocal;
+        if (multisampled()) {
+            swapchainResources.colorAttachment = makeImageAttachment(vlk, {
+                .flags = {},
+                .imageType = vk::ImageType::e2D,
+                .format = renderTarget.format,
+                .extent = {
+                    extent.width,
+                    extent.height,
+                    1
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = sampleCount,
+                .tiling = vk::ImageTiling::eOptimal,
+                .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment,
+                .sharingMode = vk::SharingMode::eExclusive,
+                .queueFamilyIndexCount = 0,
+                .pQueueFamilyIndices = nullptr,
+                .initialLayout = vk::ImageLayout::eUndefined,
+            }, memoryProperties, vk::ImageAspectFlagBits::eColor);
+        }
+        if (upscaled()) {
+            swapchainResources.sceneColor = makeImageAttachment(vlk, {
+                .flags = {},
+                .imageType = vk::ImageType::e2D,
+                .format = renderTarget.format,
+                .extent = {
+                    .width = extent.width,
+                    .height = extent.height,
+                    .depth = 1,
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = vk::SampleCountFlagBits::e1,
+                .tiling = vk::ImageTiling::eOptimal,
+                .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+                .sharingMode = vk::SharingMode::eExclusive,
+                .queueFamilyIndexCount = 0,
+                .pQueueFamilyIndices = nullptr,
+                .initialLayout = vk::ImageLayout::eUndefined,
+            }, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eColor);
+        }
         swapchainResources.depthAttachment = makeImageAttachment(vlk, {
             .flags = {},
             .imageType = vk::ImageType::e2D,
-            .format = vk::Format::eD32Sfloat,
+            .format = depthFormat,
             .extent = {
-                .width = renderTarget.extent.width,
-                .height = renderTarget.extent.height,
+                .width = extent.width,
+                .height = extent.height,
                 .depth = 1,
             },
             .mipLevels = 1,
             .arrayLayers = 1,
             .samples = sampleCount,
             .tiling = vk::ImageTiling::eOptimal,
-            .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
+            .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransientAttachment,
             .sharingMode = vk::SharingMode::eExclusive,
             .queueFamilyIndexCount = 0,
             .pQueueFamilyIndices = nullptr, // For shared sharingMode
             .initialLayout = vk::ImageLayout::eUndefined,
-        }, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eDepth);
+        }, memoryProperties, vk::ImageAspectFlagBits::eDepth);
+    }
+
+    void createSwapchainResources() {
+        createAttachments();
+        // Framebuffers are cheap, but they reference the render target's image views
+        for (auto& e : swapchainResources.framebuffers) {
+            vlk->deletionQueue->push(std::move(e));
+        }
         swapchainResources.framebuffers.clear();
-        for (const auto& resolveImageView : renderTarget.imageViews) {
-            const auto attachments = std::to_array({
-                swapchainResources.colorAttachment.imageView.get(),
-                swapchainResources.depthAttachment.imageView.get(),
-                resolveImageView,
-            });
+        const auto createFramebuffer = [&](vk::ImageView outputView, vk::Extent2D extent) {
+            const auto attachments = multisampled()
+                ? std::vector({swapchainResources.colorAttachment.imageView.get(), swapchainResources.depthAttachment.imageView.get(), outputView})
+                : std::vector({outputView, swapchainResources.depthAttachment.imageView.get()});
             swapchainResources.framebuffers.push_back(vlk->device->createFramebufferUnique({
                 .flags = {},
                 .renderPass = renderPass.get(),
-                .attachmentCount = attachments.size(),
+                .attachmentCount = (uint32_t) attachments.size(),
                 .pAttachments = attachments.data(),
-                .width = renderTarget.extent.width,
-                .height = renderTarget.extent.height,
+                .width = extent.width,
+                .height = extent.height,
                 .layers = 1,
             }));
+        };
+        if (upscaled()) {
+            createFramebuffer(swapchainResources.sceneColor.imageView.get(), swapchainResources.attachmentExtent);
+            return;
+        }
+        for (const auto& targetImageView : renderTarget.imageViews) {
+            createFramebuffer(targetImageView, renderTarget.extent);
         }
     }
 
+    // Scales the rendered part of sceneColor up to the whole render target image
+    void recordUpscale(vk::CommandBuffer commandBuffer, vk::Image target) {
+        using layout = vk::ImageLayout;
+        using access = vk::AccessFlagBits;
+        using stage = vk::PipelineStageFlagBits;
+        constexpr vk::ImageSubresourceRange range = {
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+        const auto barrier = [&range](vk::Image image, layout oldLayout, layout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess) {
+            return vk::ImageMemoryBarrier {
+                .srcAccessMask = srcAccess,
+                .dstAccessMask = dstAccess,
+                .oldLayout = oldLayout,
+                .newLayout = newLayout,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .image = image,
+                .subresourceRange = range,
+            };
+        };
+        // The render pass already left sceneColor in eTransferSrcOptimal
+        const auto preBlitBarriers = std::to_array({
+            barrier(swapchainResources.sceneColor.image.get(), layout::eTransferSrcOptimal, layout::eTransferSrcOptimal, access::eColorAttachmentWrite, access::eTransferRead),
+            barrier(target, layout::eUndefined, layout::eTransferDstOptimal, access::eNone, access::eTransferWrite),
+        });
+        commandBuffer.pipelineBarrier(stage::eColorAttachmentOutput | stage::eTransfer, stage::eTransfer, {}, nullptr, nullptr, preBlitBarriers);
+        constexpr vk::ImageSubresourceLayers subresource = {
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+        commandBuffer.blitImage(
+            swapchainResources.sceneColor.image.get(), layout::eTransferSrcOptimal,
+            target, layout::eTransferDstOptimal,
+            vk::ImageBlit {
+                .srcSubresource = subresource,
+                .srcOffsets = std::to_array<vk::Offset3D>({
+                    {0, 0, 0},
+                    {(int32_t) renderExtent.width, (int32_t) renderExtent.height, 1},
+                }),
+                .dstSubresource = subresource,
+                .dstOffsets = std::to_array<vk::Offset3D>({
+                    {0, 0, 0},
+                    {(int32_t) renderTarget.extent.width, (int32_t) renderTarget.extent.height, 1},
+                }),
+            },
+            vk::Filter::eLinear
+        );
+        commandBuffer.pipelineBarrier(stage::eTransfer, stage::eAllCommands, {}, nullptr, nullptr,
+            barrier(target, layout::eTransferDstOptimal, renderTarget.finalLayout, access::eTransferWrite, access::eMemoryRead));
+    }
+
 public:
     void setRenderTarget(RenderTarget newRenderTarget) {
         renderTarget = std::move(newRenderTarget);
+        if (upscaled()) {
+            const auto features = vlk->physicalDevice.getFormatProperties(renderTarget.format).optimalTilingFeatures;
+            using f = vk::FormatFeatureFlagBits;
+            const bool canBlit = (features & (f::eBlitSrc | f::eBlitDst | f::eSampledImageFilterLinear)) == (f::eBlitSrc | f::eBlitDst | f::eSampledImageFilterLinear);
+            if (!canBlit || !(renderTarget.usage & vk::ImageUsageFlagBits::eTransferDst)) {
+                prn("Render target can't be blitted to, dynamic resolution disabled");
+                dynamicResolution.reset();
+            }
+        }
         createRenderPass();
         createSwapchainResources();
     }
     void updateRenderTarget(RenderTarget newRenderTarget) {
         const auto old = std::exchange(renderTarget, newRenderTarget);
-        if (old.format != renderTarget.format) {
+        if (old.format != renderTarget.format || old.finalLayout != renderTarget.finalLayout) {
+            vlk->deletionQueue->push(std::move(renderPass));
             createRenderPass();
         }
         createSwapchainResources();
@@ -420,45 +815,370 @@ public:
     }
 
 public:
-    explicit ForwardRenderer(const GraphicsContext* vlk) : vlk(vlk) {
-        sampleCount = vlk->props.maxSampleCount;
+    explicit ForwardRenderer(const GraphicsContext* vlk, const ForwardRendererOptions& options = {}) : vlk(vlk) {
+        sampleCount = std::min(options.sampleCount, vlk->props.maxSampleCount);
+        depthFormat = [&] {
+            const auto candidates = std::to_array({
+                options.depthFormat,
+                vk::Format::eD32Sfloat,
+                vk::Format::eX8D24UnormPack32,
+                vk::Format::eD16Unorm, // Always supported
+            });
+            for (const auto format : candidates) {
+                const auto features = vlk->physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+                if (features & vk::FormatFeatureFlagBits::eDepthStencilAttachment) { return format; }
+            }
+            throw ex::runtime("no supported depth format");
+        }();
+        prn("Forward renderer:", fmt_raw(static_cast<uint32_t>(sampleCount), "x MSAA,"), vk::to_string(depthFormat));
+        if (options.dynamicResolution) {
+            dynamicResolution.emplace(*options.dynamicResolution);
+        }
+        if (options.recordingThreads > 1) {
+            workers = std::make_unique<WorkerPool>(options.recordingThreads);
+        }
+        vertexPulling = options.vertexPulling && vlk->props.bufferDeviceAddress;
+        if (options.vertexPulling && !vertexPulling) {
+            prn("Buffer device address unsupported, vertex pulling disabled");
+        }
     }
 
+    // Called at the end of each frame (each view) with the finished render target image, left in renderTarget.finalLayout.
+    // Commands recorded into the frame's command buffer here run after rendering, e.g. a readback.
+    std::function<void(vk::CommandBuffer, const Frame&, vk::Image)> onFrameRendered;
+
+    // Feeds the dynamic resolution controller, call once per frame before startFrame()
+    void updateResolutionScale(double gpuTime) {
+        if (dynamicResolution) { dynamicResolution->update(gpuTime); }
+    }
+    float resolutionScale() const { return dynamicResolution ? dynamicResolution->scale() : 1.0f; }
+
     void registerMaterialType(vk::DescriptorSetLayout descriptorSetLayout) {
-        auto pipelineLayout = createPipelineLayout(
-            vlk,
-            std::to_array({descriptorSetLayout}),
-            std::to_array({
-                vk::PushConstantRange {
-                    .stageFlags = vk::ShaderStageFlagBits::eVertex,
-                    .offset = 0,
-                    .size = sizeof(Matrix4),
-                }
-            })
-        );
-        auto pipeline = makeGraphicsPipeline(vlk, pipelineLayout.get(), renderPass.get(), 0);
+        // Transforms come from the instance buffer
+        const vk::PushConstantRange pullingConstants = {
+            .stageFlags = vk::ShaderStageFlagBits::eVertex,
+            .offset = 0,
+            .size = sizeof(VertexPullingConstants),
+        };
+        auto pipelineLayout = createPipelineLayout(vlk, std::to_array({descriptorSetLayout}),
+            vertexPulling ? std::span(&pullingConstants, 1) : std::span<const vk::PushConstantRange>());
+        auto pipeline = makeGraphicsPipeline(vlk, pipelineLayout.get(), renderPass.get(), 0, sampleCount, vertexPulling);
         registeredMaterials.emplace(descriptorSetLayout, RegisteredMaterialType {
             .pipelineLayout = std::move(pipelineLayout),
             .pipeline = std::move(pipeline),
+            .id = nextMaterialTypeId++,
         });
     }
 
+    // Pipelines are destroyed once frames that used them have finished
+    void unregisterMaterialType(vk::DescriptorSetLayout descriptorSetLayout) {
+        const auto it = registeredMaterials.find(descriptorSetLayout);
+        assert(it != registeredMaterials.end());
+        vlk->deletionQueue->push(std::move(it->second));
+        registeredMaterials.erase(it);
+    }
+
+private:
+    InstanceRange allocateInstances(uint32_t count) {
+        if (instanceBuffers.size() <= currentFrame.frameIndex) {
+            instanceBuffers.resize(currentFrame.frameIndex + 1);
+        }
+        auto& instanceBuffer = instanceBuffers[currentFrame.frameIndex];
+        if (usedInstances + count > instanceBuffer.capacity) {
+            // Draws recorded earlier in this frame keep the old buffer alive until the frame has finished
+            if (instanceBuffer.capacity != 0) {
+                vlk->deletionQueue->push(std::move(instanceBuffer.buffer));
+            }
+            instanceBuffer.capacity = std::bit_ceil(std::max({count, instanceBuffer.capacity * 2, 1024u}));
+            using usage = vk::BufferUsageFlagBits;
+            const auto bufferUsage = vertexPulling ? usage::eStorageBuffer | usage::eShaderDeviceAddress : usage::eVertexBuffer;
+            instanceBuffer.buffer = makeMappedBuffer(vlk, instanceBuffer.capacity * sizeof(InstanceData), bufferUsage);
+            instanceBuffer.address = vertexPulling ? vlk->device->getBufferAddress({.buffer = instanceBuffer.buffer.buffer.first.get()}) : 0;
+            usedInstances = 0;
+        }
+        const InstanceRange range = {
+            .buffer = instanceBuffer.buffer.buffer.first.get(),
+            .address = instanceBuffer.address,
+            .first = usedInstances,
+            .data = static_cast<InstanceData*>(instanceBuffer.buffer.mapping) + usedInstances,
+        };
+        usedInstances += count;
+        return range;
+    }
+
+    // One instanced draw per mesh and material, in key order
+    // The binds recording the queued draws one by one in submission order would take, for comparison.
+    // Same decisions as CommandRecorder::draw() in the current mode, with their instances in `instances`
+    void countSubmittedBinds(const InstanceRange& instances) {
+        auto& s = submittedState;
+        const auto changed = [](auto& last, auto value) { return std::exchange(last, value) != value; };
+        for (const auto& e : queuedDraws) {
+            if (!vertexPulling) {
+                submittedBinds.vertexBuffers += changed(s.vertexBuffer, e.mesh.vertexBuffer);
+            }
+            if (e.mesh.indexed) {
+                submittedBinds.indexBuffers += changed(s.indexBuffer, e.mesh.indexBuffer);
+            }
+            submittedBinds.pipelines += changed(s.pipeline, e.materialType->pipeline.get());
+            submittedBinds.descriptorSets += changed(s.descriptorSet, e.material.descriptorSet);
+            if (vertexPulling) {
+                submittedBinds.pushConstants += changed(s.pullingConstants, pullingConstants(e.mesh, instances));
+            } else {
+                submittedBinds.instanceBuffers += changed(s.instanceBuffer, instances.buffer);
+            }
+        }
+        submittedBinds.draws += queuedDraws.size();
+    }
+
+    // One instanced draw per run of equal state, in SortKey order
+    void recordQueuedDraws() {
+        if (queuedDraws.empty()) { return; }
+        renderQueue.clear();
+        for (uint32_t i = 0; i < queuedDraws.size(); i++) {
+            const auto& e = queuedDraws[i];
+            // Clip space w of the object's origin, equal in the transposed matrix
+            const float viewDepth = e.instance.mvp(3, 3);
+            renderQueue.push(SortKey::make(e.materialType->id, materialIds(e.material.descriptorSet), meshIds((uint64_t) e.mesh.firstIndex << 32 | e.mesh.vertexOffset), viewDepth), i);
+        }
+        const auto order = renderQueue.sort();
+        drawGroups.clear();
+        for (uint32_t first = 0; first < order.size();) {
+            const auto state = queuedDraws[order[first].index].state();
+            uint32_t last = first + 1;
+            while (last < order.size() && queuedDraws[order[last].index].state() == state) { last++; }
+            drawGroups.push_back({
+                .first = first,
+                .count = last - first,
+            });
+            first = last;
+        }
+        const auto instances = allocateInstances((uint32_t) order.size());
+        countSubmittedBinds(instances);
+        const auto recordGroups = [&](CommandRecorder& recorder, std::span<const DrawGroup> groups) {
+            for (const auto& group : groups) {
+                for (uint32_t i = group.first; i < group.first + group.count; i++) {
+                    instances.data[i] = queuedDraws[order[i].index].instance;
+                }
+                const auto& e = queuedDraws[order[group.first].index];
+                recorder.draw(
+                    e.mesh, e.materialType->pipeline.get(), e.materialType->pipelineLayout.get(), e.material,
+                    instances, group.first, group.count
+                );
+            }
+        };
+        const uint32_t chunkCount = workers ? std::min(workers->size(), (uint32_t) drawGroups.size() / minGroupsPerChunk) : 0;
+        if (chunkCount < 2) {
+            beginRenderPass(vk::SubpassContents::eInline);
+            recordGroups(commandRecorder, drawGroups);
+        } else {
+            beginRenderPass(vk::SubpassContents::eSecondaryCommandBuffers);
+            auto& pools = recordingPools[currentFrame.frameIndex];
+            std::vector<vk::CommandBuffer> secondaryCommandBuffers(chunkCount);
+            std::vector<BindCounts> chunkCounts(chunkCount);
+            workers->run(chunkCount, [&](uint32_t chunk) {
+                auto& pool = pools[chunk];
+                if (pool.used == pool.commandBuffers.size()) {
+                    pool.commandBuffers.push_back(std::move(vlk->device->allocateCommandBuffersUnique({
+                        .commandPool = pool.commandPool.get(),
+                        .level = vk::CommandBufferLevel::eSecondary,
+                        .commandBufferCount = 1,
+                    })[0]));
+                }
+                const vk::CommandBuffer commandBuffer = pool.commandBuffers[pool.used++].get();
+                CommandRecorder recorder {commandBuffer, vertexPulling};
+                recorder.beginSecondary(renderPass.get(), currentFramebuffer(), renderExtent);
+                const size_t begin = drawGroups.size() * chunk / chunkCount;
+                const size_t end = drawGroups.size() * (chunk + 1) / chunkCount;
+                recordGroups(recorder, std::span(drawGroups).subspan(begin, end - begin));
+                recorder.end();
+                secondaryCommandBuffers[chunk] = commandBuffer;
+                chunkCounts[chunk] = recorder.counts;
+            });
+            commandRecorder.executeCommands(secondaryCommandBuffers);
+            for (const auto& counts : chunkCounts) {
+                commandRecorder.counts.pipelines += counts.pipelines;
+                commandRecorder.counts.descriptorSets += counts.descriptorSets;
+                commandRecorder.counts.vertexBuffers += counts.vertexBuffers;
+                commandRecorder.counts.indexBuffers += counts.indexBuffers;
+                commandRecorder.counts.instanceBuffers += counts.instanceBuffers;
+                commandRecorder.counts.pushConstants += counts.pushConstants;
+                commandRecorder.counts.draws += counts.draws;
+            }
+        }
+        queuedDraws.clear();
+        materialIds.clear();
+        meshIds.clear();
+    }
+
+    void beginView() {
+        if (upscaled() && currentView != 0) {
+            // The previous view's blit must finish reading sceneColor before it is rendered to again
+            currentFrame.commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, nullptr, nullptr, nullptr
+            );
+        }
+        // Begun once it is known whether the view is recorded inline or in secondary command buffers
+        renderPassBegun = false;
+    }
+
+    vk::Framebuffer currentFramebuffer() const {
+        return swapchainResources.framebuffers[upscaled() ? 0 : currentFrame.imageIndex + currentView].get();
+    }
+
+    void beginRenderPass(vk::SubpassContents contents) {
+        if (renderPassBegun) { return; }
+        renderPassBegun = true;
+        commandRecorder.beginRenderPass(renderPass.get(), currentFramebuffer(), renderExtent, contents);
+    }
+
+    void endView() {
+        const vk::Image image = renderTarget.images[currentFrame.imageIndex + currentView];
+        recordQueuedDraws();
+        beginRenderPass(vk::SubpassContents::eInline); // Still clears without draws
+        commandRecorder.endRenderPass();
+        if (upscaled()) {
+            recordUpscale(currentFrame.commandBuffer, image);
+        }
+        if (onFrameRendered) {
+            onFrameRendered(currentFrame.commandBuffer, currentFrame, image);
+        }
+    }
+
+public:
     void startFrame(Frame frame) {
-        commandRecorder = CommandRecorder {frame.commandBuffer};
-        commandRecorder.start(
-            renderPass.get(),
-            swapchainResources.framebuffers[frame.imageIndex].get(),
-            renderTarget.extent
-        );
+        currentFrame = frame;
+        currentView = 0;
+        usedInstances = 0;
+        renderExtent = renderTarget.extent;
+        if (upscaled()) {
+            renderExtent = DynamicResolution::scaled(renderTarget.extent, dynamicResolution->scale());
+            renderExtent.width = std::min(renderExtent.width, swapchainResources.attachmentExtent.width);
+            renderExtent.height = std::min(renderExtent.height, swapchainResources.attachmentExtent.height);
+        }
+        if (workers) {
+            // The render target waited for the frame that last used this slot
+            if (recordingPools.size() <= frame.frameIndex) {
+                recordingPools.resize(frame.frameIndex + 1);
+            }
+            auto& pools = recordingPools[frame.frameIndex];
+            while (pools.size() < workers->size()) {
+                pools.push_back({
+                    .commandPool = vlk->device->createCommandPoolUnique({
+                        .flags = vk::CommandPoolCreateFlagBits::eTransient,
+                        .queueFamilyIndex = vlk->props.graphicsQueueFamily,
+                    }),
+                });
+            }
+            for (auto& pool : pools) {
+                if (pool.used == 0) { continue; }
+                vlk->device->resetCommandPool(pool.commandPool.get());
+                pool.used = 0;
+            }
+        }
+        commandRecorder = CommandRecorder {frame.commandBuffer, vertexPulling};
+        submittedState = {};
+        commandRecorder.begin();
+        beginView();
+    }
+
+    // For frames with several views (Frame::viewCount): finishes the current image and starts the next one.
+    // All views share pipelines, attachments and the frame's command buffer, so they go out in one submit.
+    void nextView() {
+        assert(currentView + 1 < currentFrame.viewCount);
+        endView();
+        currentView++;
+        beginView();
     }
 
+    // Queued until the end of the view, then draws of the same mesh and material are merged into one instanced draw
     void draw(const Mesh& mesh, const Material& material, const Matrix4& mvp) {
+        queuedDraws.push_back({
+            .mesh = mesh,
+            .material = material,
+            .materialType = &registeredMaterials.at(material.descriptorSetLayout),
+            .instance = {.mvp = mvp},
+        });
+    }
+
+    // Milliseconds to record `count` single-instance draws through dispatcher `d`, into a scratch command buffer
+    // that is reset afterwards and never submitted. Between startFrame() and endFrame(), the draws share one instance
+    template <typename Dispatch = VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>
+    double benchmarkRecording(const Mesh& mesh, const Material& material, const Matrix4& mvp, size_t count, const Dispatch& d = VULKAN_HPP_DEFAULT_DISPATCHER) {
+        if (!scratchCommandPool) {
+            scratchCommandPool = vlk->device->createCommandPoolUnique({
+                .flags = vk::CommandPoolCreateFlagBits::eTransient,
+                .queueFamilyIndex = vlk->props.graphicsQueueFamily,
+            });
+            scratchCommandBuffer = std::move(vlk->device->allocateCommandBuffersUnique({
+                .commandPool = scratchCommandPool.get(),
+                .level = vk::CommandBufferLevel::ePrimary,
+                .commandBufferCount = 1,
+            })[0]);
+        }
         const auto& registeredMaterial = registeredMaterials.at(material.descriptorSetLayout);
-        commandRecorder.draw(mesh, registeredMaterial.pipeline.get(), registeredMaterial.pipelineLayout.get(), material, mvp);
+        const auto instance = allocateInstances(1);
+        instance.data->mvp = mvp;
+        CommandRecorder recorder {scratchCommandBuffer.get(), vertexPulling};
+        recorder.begin();
+        recorder.beginRenderPass(renderPass.get(), currentFramebuffer(), renderExtent);
+        Stopwatch st;
+        for (size_t i = 0; i < count; i++) {
+            recorder.draw(mesh, registeredMaterial.pipeline.get(), registeredMaterial.pipelineLayout.get(), material, instance, 0, 1, d);
+        }
+        const double elapsed = st.ping();
+        recorder.endRenderPass();
+        recorder.end();
+        vlk->device->resetCommandPool(scratchCommandPool.get());
+        return elapsed;
+    }
+
+    // World to clip space of `camera` on the current render target, untransposed
+    Matrix4 viewProjection(const RenderPacket::Camera& camera) const {
+        const float aspect = (float) renderTarget.extent.width / renderTarget.extent.height;
+        return Transform::PerspectiveProjection(camera.fov, aspect, camera.nearFar) * Transform::y_flip * camera.view;
+    }
+
+    // Draws a whole packet, one camera per view of the frame
+    void drawPacket(const RenderPacket& packet) {
+        assert(currentView == 0 && packet.views.size() == currentFrame.viewCount);
+        for (size_t v = 0; v < packet.views.size(); v++) {
+            if (v != 0) { nextView(); }
+            const Matrix4 worldToClip = viewProjection(packet.views[v]);
+            for (const auto& item : packet.draws) {
+                draw(*item.mesh, *item.material, (worldToClip * item.model).Transposed());
+            }
+        }
     }
 
     void endFrame() {
+        assert(currentView + 1 == currentFrame.viewCount);
+        endView();
         commandRecorder.end();
+        const auto& counts = commandRecorder.counts;
+        recordedBinds.pipelines += counts.pipelines;
+        recordedBinds.descriptorSets += counts.descriptorSets;
+        recordedBinds.vertexBuffers += counts.vertexBuffers;
+        recordedBinds.indexBuffers += counts.indexBuffers;
+        recordedBinds.instanceBuffers += counts.instanceBuffers;
+        recordedBinds.pushConstants += counts.pushConstants;
+        recordedBinds.draws += counts.draws;
+        recordedFrames++;
+    }
+
+    // Per frame averages of the binds and draws the queued draws would take in submission order, and what was recorded after sorting and instancing
+    void printBindStats() const {
+        if (recordedFrames == 0) { return; }
+        const auto perFrame = [this](uint64_t submitted, uint64_t recorded) {
+            return fmt_raw((double) submitted / recordedFrames, " -> ", (double) recorded / recordedFrames);
+        };
+        prn_raw("Per frame, submission order -> sorted: ",
+                perFrame(submittedBinds.pipelines, recordedBinds.pipelines), " pipelines, ",
+                perFrame(submittedBinds.descriptorSets, recordedBinds.descriptorSets), " descriptor sets, ",
+                perFrame(submittedBinds.vertexBuffers, recordedBinds.vertexBuffers), " vertex buffers, ",
+                perFrame(submittedBinds.indexBuffers, recordedBinds.indexBuffers), " index buffers, ",
+                perFrame(submittedBinds.instanceBuffers, recordedBinds.instanceBuffers), " instance buffers, ",
+                perFrame(submittedBinds.pushConstants, recordedBinds.pushConstants), " push constant updates, ",
+                perFrame(submittedBinds.draws, recordedBinds.draws), " draws");
     }
 
 };
@@ -0,0 +1,209 @@
+#pragma once
+#include <map>
+#include <memory>
+#include "vlk/GraphicsContext.h"
+
+// Where a vertex pulling shader finds the attributes of a vertex, in bytes. Multiples of 4, attributes are 32-bit floats
+struct VertexLayout {
+    uint32_t stride;
+    uint32_t positionOffset; // vec3
+    uint32_t uvOffset;       // vec2
+};
+
+// Range of a GeometryPool block. Meshes in the same block share their vertex and index buffers,
+// so drawing one after another binds nothing
+struct Mesh {
+    vk::Buffer vertexBuffer;
+    vk::Buffer indexBuffer;
+    vk::DeviceAddress vertexAddress; // Of vertexBuffer, 0 without GraphicsContext::props.bufferDeviceAddress
+    VertexLayout layout;
+    uint32_t vertexOffset; // Added to every index
+    uint32_t firstIndex;
+    size_t nVertices;
+    size_t nIndices;
+    bool indexed;
+};
+
+// First-fit allocator of ranges in units of elements, adjacent free ranges are merged
+class RangeAllocator {
+    std::map<uint32_t, uint32_t> freeRanges; // Offset to size
+
+public:
+    explicit RangeAllocator(uint32_t capacity) {
+        if (capacity != 0) { freeRanges.emplace(0, capacity); }
+    }
+
+    std::optional<uint32_t> alloc(uint32_t size) {
+        assert(size != 0);
+        const auto it = std::ranges::find_if(freeRanges, [size](const auto& e) { return e.second >= size; });
+        if (it == freeRanges.end()) { return std::nullopt; }
+        const auto [offset, available] = *it;
+        freeRanges.erase(it);
+        if (available > size) {
+            freeRanges.emplace(offset + size, available - size);
+        }
+        return offset;
+    }
+
+    void free(uint32_t offset, uint32_t size) {
+        auto next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            next = freeRanges.erase(next);
+        }
+        if (next != freeRanges.begin()) {
+            const auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+        freeRanges.emplace_hint(next, offset, size);
+    }
+};
+
+// Large shared vertex and index buffers for every mesh with one vertex layout, sub-allocated per mesh.
+// A new block is added when no existing one has room; the buffers are never moved, so AssetPool::compact() doesn't apply.
+class GeometryPool {
+    const GraphicsContext* vlk;
+    VertexLayout layout;
+    uint32_t verticesPerBlock;
+    uint32_t indicesPerBlock;
+    struct Block {
+        BufferResource vertices;
+        BufferResource indices;
+        vk::DeviceAddress vertexAddress;
+        RangeAllocator vertexRanges;
+        RangeAllocator indexRanges;
+    };
+    std::vector<std::unique_ptr<Block>> blocks; // Stable addresses, deferred frees refer to them
+
+    BufferResource createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage) const {
+        const vk::BufferCreateInfo info = {
+            .flags = {},
+            .size = size,
+            .usage = usage | vk::BufferUsageFlagBits::eTransferDst,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+        };
+        using mem = vk::MemoryPropertyFlagBits;
+        const auto properties = vlk->props.zeroCopyUploads ? mem::eDeviceLocal | mem::eHostVisible | mem::eHostCoherent : mem::eDeviceLocal;
+        auto [buffer, memory] = vlk->createBuffer(info, properties, MemoryCategory::mesh);
+        return BufferResource {
+            .buffer = std::move(buffer),
+            .memory = std::move(memory),
+            .info = info,
+        };
+    }
+
+    Block& addBlock(uint32_t minVertices, uint32_t minIndices) {
+        const uint32_t vertexCapacity = std::max(verticesPerBlock, minVertices);
+        const uint32_t indexCapacity = std::max(indicesPerBlock, minIndices);
+        using usage = vk::BufferUsageFlagBits;
+        // Vertex pulling reads the vertices through their address instead of a vertex input binding
+        const auto vertexUsage = vlk->props.bufferDeviceAddress ? usage::eVertexBuffer | usage::eStorageBuffer | usage::eShaderDeviceAddress : usage::eVertexBuffer;
+        auto vertices = createBuffer((vk::DeviceSize) vertexCapacity * layout.stride, vertexUsage);
+        const auto vertexAddress = vlk->props.bufferDeviceAddress ? vlk->device->getBufferAddress({.buffer = vertices.buffer.get()}) : 0;
+        blocks.push_back(std::make_unique<Block>(Block {
+            .vertices = std::move(vertices),
+            .indices = createBuffer((vk::DeviceSize) indexCapacity * sizeof(uint32_t), usage::eIndexBuffer),
+            .vertexAddress = vertexAddress,
+            .vertexRanges = RangeAllocator(vertexCapacity),
+            .indexRanges = RangeAllocator(indexCapacity),
+        }));
+        return *blocks.back();
+    }
+
+    // Copies into a range nothing in flight reads.
+    // Staged copies run on the graphics queue: the buffers stay owned by it while other ranges are drawn from
+    void write(const BufferResource& buffer, vk::DeviceSize offset, std::span<const std::byte> bytes) const {
+        if (vlk->props.zeroCopyUploads) {
+            memcpy(static_cast<std::byte*>(buffer.memory.mapping()) + offset, bytes.data(), bytes.size());
+            return;
+        }
+        for (size_t done = 0; done < bytes.size(); done += vlk->stagingRing->chunkSize()) {
+            const auto chunk = bytes.subspan(done, std::min<size_t>(vlk->stagingRing->chunkSize(), bytes.size() - done));
+            const auto staging = vlk->uploads->stage(chunk.size());
+            std::ranges::copy(chunk, staging.data.begin());
+            const auto commandBuffer = vlk->uploads->graphicsCommandBuffer();
+            GraphicsContext::cmdCopyBuffer(commandBuffer, staging.buffer, staging.offset, buffer.buffer.get(), offset + done, chunk.size());
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader, {}, nullptr,
+                vk::BufferMemoryBarrier {
+                    .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+                    .dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead,
+                    .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                    .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                    .buffer = buffer.buffer.get(),
+                    .offset = offset + done,
+                    .size = chunk.size(),
+                },
+                nullptr
+            );
+        }
+    }
+
+public:
+    GeometryPool(const GraphicsContext* vlk, VertexLayout layout, uint32_t verticesPerBlock = 1 << 20, uint32_t indicesPerBlock = 1 << 22)
+        : vlk(vlk), layout(layout), verticesPerBlock(verticesPerBlock), indicesPerBlock(indicesPerBlock) {}
+    GeometryPool(const GeometryPool&) = delete;
+    GeometryPool& operator=(const GeometryPool&) = delete;
+
+    // Without indices the mesh is drawn as a plain triangle list
+    template <typename Vertex>
+    Mesh add(std::span<Vertex> vertices, std::span<const uint32_t> indices = {}) {
+        assert(sizeof(Vertex) == layout.stride && !vertices.empty());
+        const auto nVertices = (uint32_t) vertices.size();
+        const auto nIndices = (uint32_t) indices.size();
+        const auto tryAlloc = [&](Block& block) -> std::optional<std::pair<uint32_t, uint32_t>> {
+            const auto vertexOffset = block.vertexRanges.alloc(nVertices);
+            if (!vertexOffset) { return std::nullopt; }
+            if (nIndices == 0) { return std::pair(*vertexOffset, 0u); }
+            if (const auto firstIndex = block.indexRanges.alloc(nIndices)) { return std::pair(*vertexOffset, *firstIndex); }
+            block.vertexRanges.free(*vertexOffset, nVertices);
+            return std::nullopt;
+        };
+        Block* block = nullptr;
+        std::optional<std::pair<uint32_t, uint32_t>> offsets;
+        for (const auto& e : blocks) {
+            if ((offsets = tryAlloc(*e))) {
+                block = e.get();
+                break;
+            }
+        }
+        if (!block) {
+            block = &addBlock(nVertices, nIndices);
+            offsets = tryAlloc(*block);
+        }
+        const auto [vertexOffset, firstIndex] = *offsets;
+        write(block->vertices, (vk::DeviceSize) vertexOffset * layout.stride, std::as_bytes(vertices));
+        if (nIndices != 0) {
+            write(block->indices, (vk::DeviceSize) firstIndex * sizeof(uint32_t), std::as_bytes(indices));
+        }
+        return Mesh {
+            .vertexBuffer = block->vertices.buffer.get(),
+            .indexBuffer = block->indices.buffer.get(),
+            .vertexAddress = block->vertexAddress,
+            .layout = layout,
+            .vertexOffset = vertexOffset,
+            .firstIndex = firstIndex,
+            .nVertices = nVertices,
+            .nIndices = nIndices,
+            .indexed = nIndices != 0,
+        };
+    }
+
+    // The ranges are reused once frames that draw the mesh have finished
+    void release(const Mesh& mesh) {
+        const auto it = std::ranges::find_if(blocks, [&](const auto& e) { return e->vertices.buffer.get() == mesh.vertexBuffer; });
+        assert(it != blocks.end());
+        vlk->deletionQueue->defer([block = it->get(), mesh] {
+            block->vertexRanges.free(mesh.vertexOffset, mesh.nVertices);
+            if (mesh.indexed) {
+                block->indexRanges.free(mesh.firstIndex, mesh.nIndices);
+            }
+        });
+    }
+
+    size_t blockCount() const { return blocks.size(); }
+};
@@ -21,6 +21,11 @@ struct MaterialType {
         };
         return ret;
     }
+    // Points the material at new textures. Sets may be in use by frames in flight,
+    // so a new one is written and the old one is freed later.
+    void updateMaterial(Material& material, std::span<const Texture> textures) const {
+        descriptorPool.free(std::exchange(material.descriptorSet, makeMaterial(textures).descriptorSet));
+    }
 };
 
 inline auto makeMaterialType(const GraphicsContext* vlk, std::span<const vk::DescriptorSetLayoutBinding> bindings) {
@@ -1,25 +1,23 @@
 #pragma once
 #include "vlk/GraphicsContext.h"
-#include "vlk/AssetPool.h"
+#include "GeometryPool.h"
 #include "load_obj.h"
 
-struct Mesh {
-    vk::Buffer vertexBuffer;
-    vk::Buffer indexBuffer;
-    size_t nVertices;
-    size_t nIndices;
-    bool indexed;
+using ObjVertex = std::ranges::range_value_t<decltype(load_obj({}).first)>;
+
+// Vertex layout of meshes loaded by makeMesh(), for their GeometryPool
+inline constexpr VertexLayout objVertexLayout = {
+    .stride = sizeof(ObjVertex),
+    .positionOffset = offsetof(ObjVertex, pos),
+    .uvOffset = offsetof(ObjVertex, uv),
 };
 
-inline Mesh makeMesh(const GraphicsContext* vlk, AssetPool& assets, std::string_view path) {
+inline Mesh makeMesh(GeometryPool& geometry, std::string_view path) {
     const auto [vertices, indices] = load_obj(path);
-    const auto vertexBuffer = std::get<vk::Buffer>(assets.storeTuple(vlk->createDeviceLocalBuffer(vk::BufferUsageFlagBits::eVertexBuffer, vertices)));
-    const auto indexBuffer = std::get<vk::Buffer>(assets.storeTuple(vlk->createDeviceLocalBuffer(vk::BufferUsageFlagBits::eIndexBuffer, indices)));
-    return Mesh {
-        .vertexBuffer = vertexBuffer,
-        .indexBuffer = indexBuffer,
-        .nVertices = vertices.size(),
-        .nIndices = indices.size(),
-        .indexed = true,
-    };
+    return geometry.add(std::span(vertices), std::span(indices));
+}
+
+// Safe while frames that draw the mesh are still in flight
+inline void releaseMesh(GeometryPool& geometry, const Mesh& mesh) {
+    geometry.release(mesh);
 }
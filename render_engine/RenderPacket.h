@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <vector>
+#include "Matrix.h"
+#include "Mesh.h"
+#include "Material.h"
+
+// Everything needed to record one frame, built by the simulation thread and only read once published.
+// Meshes and materials are referenced, not copied, and must outlive the packets using them.
+struct RenderPacket {
+    struct Camera {
+        Matrix4 view; // World to view space
+        float fov = 90; // Vertical, in degrees
+        std::pair<float, float> nearFar = {0.1f, 500.0f};
+    };
+    struct DrawItem {
+        const Mesh* mesh;
+        const Material* material;
+        Matrix4 model;
+    };
+
+    std::vector<Camera> views; // One per view of the frame, see Frame::viewCount
+    std::vector<DrawItem> draws; // Drawn in every view
+
+    // Keeps the capacity, packets are reused every frame
+    void clear() {
+        views.clear();
+        draws.clear();
+    }
+};
+
+// Single-producer single-consumer ring of reusable packets: the producer fills the next packet
+// while the consumer records earlier ones. Capacity 2 is double buffering, 3 triple buffering.
+// The two sides share only two counters; they block (std::atomic::wait) when the ring is full or empty, never lock.
+template <size_t Capacity>
+class RenderPacketQueue {
+    static_assert(Capacity >= 2);
+    static constexpr uint64_t closedBit = uint64_t(1) << 63;
+
+    std::array<RenderPacket, Capacity> packets;
+    alignas(64) std::atomic<uint64_t> published = 0; // Packets handed to the consumer, closedBit once no more will follow
+    alignas(64) std::atomic<uint64_t> released = 0;  // Packets the consumer is done with
+
+public:
+    // Producer: the cleared packet to fill next, waits while all of them are queued or being recorded
+    RenderPacket& beginWrite() {
+        const uint64_t count = published.load(std::memory_order_relaxed) & ~closedBit;
+        for (uint64_t r = released.load(std::memory_order_acquire); count - r == Capacity; r = released.load(std::memory_order_acquire)) {
+            released.wait(r, std::memory_order_acquire);
+        }
+        auto& packet = packets[count % Capacity];
+        packet.clear();
+        return packet;
+    }
+
+    // Producer: hands the packet from beginWrite() over
+    void publish() {
+        published.fetch_add(1, std::memory_order_release);
+        published.notify_one();
+    }
+
+    // Producer: acquire() returns nullptr once the remaining packets are consumed
+    void close() {
+        published.fetch_or(closedBit, std::memory_order_release);
+        published.notify_one();
+    }
+
+    // Consumer: the oldest published packet, valid until release(). nullptr once closed and drained
+    const RenderPacket* acquire() {
+        const uint64_t count = released.load(std::memory_order_relaxed);
+        for (uint64_t p = published.load(std::memory_order_acquire); (p & ~closedBit) == count; p = published.load(std::memory_order_acquire)) {
+            if (p & closedBit) { return nullptr; }
+            published.wait(p, std::memory_order_acquire);
+        }
+        return &packets[count % Capacity];
+    }
+
+    void release() {
+        released.fetch_add(1, std::memory_order_release);
+        released.notify_one();
+    }
+};
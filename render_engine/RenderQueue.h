@@ -0,0 +1,105 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Packed draw sort key, most significant bits first:
+// | pipeline 8 | material 14 | mesh 18 | depth 24 |
+// Draws sharing state end up adjacent and, within equal state, go front to back for early depth rejection.
+// Ids wrap around when they don't fit, which only costs state changes: draws are grouped by comparing their state, never by key.
+struct SortKey {
+    static constexpr uint32_t pipelineBits = 8;
+    static constexpr uint32_t materialBits = 14;
+    static constexpr uint32_t meshBits = 18;
+    static constexpr uint32_t depthBits = 24;
+    static_assert(pipelineBits + materialBits + meshBits + depthBits == 64);
+
+    // viewDepth: distance along the view direction, clip space w
+    static uint64_t make(uint32_t pipeline, uint32_t material, uint32_t mesh, float viewDepth) {
+        const auto field = [](uint64_t value, uint32_t bits) { return value & ((uint64_t(1) << bits) - 1); };
+        return field(pipeline, pipelineBits) << (64 - pipelineBits)
+             | field(material, materialBits) << (meshBits + depthBits)
+             | field(mesh, meshBits) << depthBits
+             | quantizeDepth(viewDepth);
+    }
+
+    // Non-negative floats order like their bit patterns, the top bits keep the exponent and leading mantissa bits
+    static uint64_t quantizeDepth(float depth) {
+        return std::bit_cast<uint32_t>(std::max(depth, 0.0f)) >> (32 - depthBits);
+    }
+};
+
+// Small dense ids for handles, so that they fit into a SortKey. Cleared whenever the draws using them are recorded
+template <typename Handle>
+class DenseIds {
+    std::unordered_map<Handle, uint32_t> ids;
+    Handle last = {};
+    uint32_t lastId = 0;
+
+public:
+    uint32_t operator()(Handle handle) {
+        // Consecutive draws mostly repeat state
+        if (handle == last && !ids.empty()) { return lastId; }
+        last = handle;
+        return lastId = ids.try_emplace(handle, (uint32_t) ids.size()).first->second;
+    }
+
+    void clear() {
+        ids.clear();
+    }
+};
+
+// Draw indices ordered by SortKey, with an LSD radix sort: linear in the draw count
+class RenderQueue {
+public:
+    struct Entry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+private:
+    std::vector<Entry> entries;
+    std::vector<Entry> scratch;
+
+public:
+    void push(uint64_t key, uint32_t index) {
+        entries.push_back({
+            .key = key,
+            .index = index,
+        });
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+    // 8 bits per pass, skipping the passes where every key has the same byte, typically most of the state bits
+    std::span<const Entry> sort() {
+        constexpr uint32_t passes = 8;
+        std::array<std::array<uint32_t, 256>, passes> histograms = {};
+        for (const auto& e : entries) {
+            for (uint32_t pass = 0; pass < passes; pass++) {
+                histograms[pass][(e.key >> (pass * 8)) & 0xff]++;
+            }
+        }
+        scratch.resize(entries.size());
+        for (uint32_t pass = 0; pass < passes; pass++) {
+            auto& histogram = histograms[pass];
+            if (std::ranges::find(histogram, (uint32_t) entries.size()) != histogram.end()) { continue; }
+            uint32_t offset = 0;
+            for (auto& count : histogram) {
+                offset += std::exchange(count, offset);
+            }
+            for (const auto& e : entries) {
+                scratch[histogram[(e.key >> (pass * 8)) & 0xff]++] = e;
+            }
+            std::swap(entries, scratch);
+        }
+        return entries;
+    }
+};
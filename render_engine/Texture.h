@@ -7,19 +7,11 @@ struct Texture {
     vk::Image image;
     vk::ImageView imageView;
     vk::Sampler sampler;
+    vk::Format format;
 };
 
-inline auto makeTexture(const GraphicsContext* vlk, AssetPool& assets, std::string_view path, vk::Format format) {
-    const int channels = std::map<vk::Format, int> {
-        {vk::Format::eR8Srgb,       1},
-        {vk::Format::eR8G8Srgb,     2},
-        {vk::Format::eR8G8B8Srgb,   3},
-        {vk::Format::eR8G8B8A8Srgb, 4},
-    }.at(format);
-    const auto img = load_image(path, channels);
-    const uint32_t mipLevels = floor(log2(std::max(img.w, img.h))) + 1;
-    const auto image = std::get<vk::Image>(assets.storeTuple(vlk->createDeviceLocalImage(img, img.w, img.h, format, mipLevels)));
-    const auto imageView = assets.store(vlk->device->createImageViewUnique({
+inline vk::UniqueImageView makeTextureView(const GraphicsContext* vlk, vk::Image image, vk::Format format) {
+    return vlk->device->createImageViewUnique({
         .flags = {},
         .image = image,
         .viewType = vk::ImageViewType::e2D,
@@ -32,7 +24,20 @@ inline auto makeTexture(const GraphicsContext* vlk, AssetPool& assets, std::stri
             .baseArrayLayer = 0,
             .layerCount = vk::RemainingArrayLayers,
         },
-    }));
+    });
+}
+
+inline auto makeTexture(const GraphicsContext* vlk, AssetPool& assets, std::string_view path, vk::Format format) {
+    const int channels = std::map<vk::Format, int> {
+        {vk::Format::eR8Srgb,       1},
+        {vk::Format::eR8G8Srgb,     2},
+        {vk::Format::eR8G8B8Srgb,   3},
+        {vk::Format::eR8G8B8A8Srgb, 4},
+    }.at(format);
+    const auto img = load_image(path, channels);
+    const uint32_t mipLevels = floor(log2(std::max(img.w, img.h))) + 1;
+    const auto image = assets.store(vlk->createDeviceLocalImage(img, img.w, img.h, format, mipLevels));
+    const auto imageView = assets.store(makeTextureView(vlk, image, format));
     const auto sampler = assets.store(vlk->device->createSamplerUnique({
         .flags = {},
         .magFilter = vk::Filter::eLinear,
@@ -55,5 +60,21 @@ inline auto makeTexture(const GraphicsContext* vlk, AssetPool& assets, std::stri
         .image = image,
         .imageView = imageView,
         .sampler = sampler,
+        .format = format,
     };
 }
+
+// Safe while frames that sample the texture are still in flight
+inline void releaseTexture(const GraphicsContext* vlk, AssetPool& assets, const Texture& texture) {
+    assets.release(texture.sampler, *vlk->deletionQueue);
+    assets.release(texture.imageView, *vlk->deletionQueue);
+    assets.release(texture.image, *vlk->deletionQueue);
+}
+
+// Points the texture at an image moved by AssetPool::compact(), descriptor sets using it must be rewritten
+inline void relocateTexture(const GraphicsContext* vlk, AssetPool& assets, Texture& texture, vk::Image from, vk::Image to) {
+    if (texture.image != from) { return; }
+    assets.release(texture.imageView, *vlk->deletionQueue);
+    texture.image = to;
+    texture.imageView = assets.store(makeTextureView(vlk, to, texture.format));
+}
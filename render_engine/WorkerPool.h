@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running indexed tasks in parallel, the calling thread takes part as well.
+// Threads are started once and sleep between runs, so a run costs a wake-up instead of thread creation.
+class WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(uint32_t)>* task = nullptr;
+    uint32_t taskCount = 0;
+    std::atomic<uint32_t> nextTask = 0;
+    uint32_t pending = 0; // Tasks not finished yet
+    uint32_t busy = 0;    // Threads inside work()
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void work() {
+        for (uint32_t i = nextTask++; i < taskCount; i = nextTask++) {
+            (*task)(i);
+            std::scoped_lock lock(mutex);
+            if (--pending == 0) { done.notify_all(); }
+        }
+    }
+
+    void runWorker() {
+        uint64_t seen = 0;
+        std::unique_lock lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) { return; }
+            seen = generation;
+            busy++;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--busy == 0) { done.notify_all(); }
+        }
+    }
+
+public:
+    // threadCount: including the calling thread
+    explicit WorkerPool(uint32_t threadCount) {
+        for (uint32_t i = 1; i < threadCount; i++) {
+            threads.emplace_back([this] { runWorker(); });
+        }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool() {
+        {
+            std::scoped_lock lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    uint32_t size() const { return threads.size() + 1; }
+
+    // Calls fn(i) for every i in [0, count) and returns once all calls have returned. Not reentrant
+    void run(uint32_t count, const std::function<void(uint32_t)>& fn) {
+        {
+            std::unique_lock lock(mutex);
+            // Threads that woke up late for the previous run must be out of work() before the task changes
+            done.wait(lock, [this] { return busy == 0; });
+            task = &fn;
+            taskCount = count;
+            nextTask = 0;
+            pending = count;
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        task = nullptr;
+    }
+};
@@ -1,14 +1,12 @@
 #version 450
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec2 in_uv;
+// Per instance
+layout (location = 2) in mat4 in_MVP;
 
 layout(location = 0) out vec2 out_uv;
 
-layout(push_constant) uniform PushConstants {
-    mat4 u_MVP;
-};
-
 void main() {
     out_uv = in_uv;
-    gl_Position = u_MVP * vec4(in_position, 1.0);
+    gl_Position = in_MVP * vec4(in_position, 1.0);
 }
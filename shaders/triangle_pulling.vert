@@ -0,0 +1,30 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+// triangle.vert with vertex pulling: attributes are fetched from buffer addresses instead of vertex input bindings
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Words {
+    float words[];
+};
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Instances {
+    mat4 mvps[];
+};
+
+// Matches VertexPullingConstants, offsets and stride in 4-byte words
+layout(push_constant) uniform Geometry {
+    Words vertices;       // Start of the vertex buffer, gl_VertexIndex already includes the mesh's vertexOffset
+    Instances instances;  // Start of the instance buffer, gl_InstanceIndex already includes firstInstance
+    uint stride;
+    uint positionOffset;
+    uint uvOffset;
+} geometry;
+
+layout(location = 0) out vec2 out_uv;
+
+void main() {
+    const uint base = gl_VertexIndex * geometry.stride;
+    const uint p = base + geometry.positionOffset;
+    const uint t = base + geometry.uvOffset;
+    const vec3 position = vec3(geometry.vertices.words[p], geometry.vertices.words[p + 1], geometry.vertices.words[p + 2]);
+    out_uv = vec2(geometry.vertices.words[t], geometry.vertices.words[t + 1]);
+    gl_Position = geometry.instances.mvps[gl_InstanceIndex] * vec4(position, 1.0);
+}
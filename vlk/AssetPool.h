@@ -1,28 +1,221 @@
 #pragma once
-#define VULKAN_HPP_NO_CONSTRUCTORS
-#include <vulkan/vulkan.hpp>
+#include <functional>
+#include "GraphicsContext.h"
 
 class AssetPool {
-    std::vector<vk::UniqueDeviceMemory> memory;
-    std::vector<vk::UniqueBuffer> buffers;
-    std::vector<vk::UniqueImage> images;
+    std::vector<BufferResource> buffers;
+    std::vector<ImageResource> images;
     std::vector<vk::UniqueImageView> imageViews;
     std::vector<vk::UniqueSampler> samplers;
     // std::vector<vk::UniqueDescriptorSet> descriptorSets;
+
+    // Copies made by compact(), swapped in once their upload ticket completes
+    template <typename Handle, typename Resource>
+    struct Relocation {
+        Handle from;
+        Resource to;
+        UploadTicket ticket;
+    };
+    std::vector<Relocation<vk::Buffer, BufferResource>> bufferRelocations;
+    std::vector<Relocation<vk::Image, ImageResource>> imageRelocations;
 private:
+    static auto handleOf(const BufferResource& v) { return v.buffer.get(); }
+    static auto handleOf(const ImageResource& v) { return v.image.get(); }
+    static auto handleOf(const auto& v) { return v.get(); }
     auto storeImpl(auto v, auto& vec) {
-        auto ret = v.get();
+        auto ret = handleOf(v);
         vec.push_back(std::move(v));
         return ret;
     }
+    static auto findImpl(auto handle, auto& vec) {
+        return std::ranges::find_if(vec, [&](const auto& e) { return handleOf(e) == handle; });
+    }
+    void releaseImpl(auto handle, auto& vec, DeletionQueue& deletionQueue) {
+        const auto it = findImpl(handle, vec);
+        assert(it != vec.end());
+        deletionQueue.push(std::move(*it));
+        *it = std::move(vec.back());
+        vec.pop_back();
+    }
+    static bool isRelocating(auto handle, const auto& relocations) {
+        return std::ranges::any_of(relocations, [&](const auto& e) { return e.from == handle; });
+    }
+
+    void finishRelocations(const GraphicsContext* vlk, auto& relocations, auto& vec, const auto& callback) {
+        std::erase_if(relocations, [&](auto& relocation) {
+            if (!vlk->uploads->isComplete(relocation.ticket)) { return false; }
+            const auto it = findImpl(relocation.from, vec);
+            if (it == vec.end()) {
+                // Released while being copied
+                vlk->deletionQueue->push(std::move(relocation.to));
+                return true;
+            }
+            const auto to = handleOf(relocation.to);
+            vlk->deletionQueue->push(std::exchange(*it, std::move(relocation.to)));
+            if (callback) {
+                callback(relocation.from, to);
+            }
+            return true;
+        });
+    }
+
+    UploadTicket relocate(const GraphicsContext* vlk, const BufferResource& from, BufferResource& to) {
+        // Zero-copy buffers stay host visible
+        auto [buffer, memory] = vlk->createBuffer(from.info, from.memory.memoryProperties(), from.memory.category());
+        to = {
+            .buffer = std::move(buffer),
+            .memory = std::move(memory),
+            .info = from.info,
+        };
+        const auto commandBuffer = vlk->uploads->graphicsCommandBuffer();
+        GraphicsContext::cmdCopyBuffer(commandBuffer, from.buffer.get(), 0, to.buffer.get(), 0, from.info.size);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+            {},
+            nullptr,
+            vk::BufferMemoryBarrier {
+                .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+                .dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                 vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .buffer = to.buffer.get(),
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            },
+            nullptr
+        );
+        return vlk->uploads->currentTicket();
+    }
+
+    // The source keeps being sampled by frames until the copy completes,
+    // so it goes back to eShaderReadOnlyOptimal right after being read
+    UploadTicket relocate(const GraphicsContext* vlk, const ImageResource& from, ImageResource& to) {
+        auto [image, memory] = vlk->createImage(from.info, from.memory.memoryProperties(), from.memory.category());
+        to = {
+            .image = std::move(image),
+            .memory = std::move(memory),
+            .info = from.info,
+        };
+        const vk::ImageSubresourceRange range = {
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = from.info.mipLevels,
+            .baseArrayLayer = 0,
+            .layerCount = from.info.arrayLayers,
+        };
+        const auto barrier = [&range](vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess) {
+            return vk::ImageMemoryBarrier {
+                .srcAccessMask = srcAccess,
+                .dstAccessMask = dstAccess,
+                .oldLayout = oldLayout,
+                .newLayout = newLayout,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .image = image,
+                .subresourceRange = range,
+            };
+        };
+        using layout = vk::ImageLayout;
+        using access = vk::AccessFlagBits;
+        const auto commandBuffer = vlk->uploads->graphicsCommandBuffer();
+        const auto preCopyBarriers = std::to_array({
+            barrier(from.image.get(), layout::eShaderReadOnlyOptimal, layout::eTransferSrcOptimal, access::eNone, access::eTransferRead),
+            barrier(to.image.get(), layout::eUndefined, layout::eTransferDstOptimal, access::eNone, access::eTransferWrite),
+        });
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eTransfer,
+            {},
+            nullptr,
+            nullptr,
+            preCopyBarriers
+        );
+        std::vector<vk::ImageCopy> regions;
+        for (uint32_t i = 0; i < from.info.mipLevels; i++) {
+            const vk::ImageSubresourceLayers subresource = {
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .mipLevel = i,
+                .baseArrayLayer = 0,
+                .layerCount = from.info.arrayLayers,
+            };
+            regions.push_back({
+                .srcSubresource = subresource,
+                .srcOffset = {0, 0, 0},
+                .dstSubresource = subresource,
+                .dstOffset = {0, 0, 0},
+                .extent = {
+                    .width = std::max(from.info.extent.width >> i, 1u),
+                    .height = std::max(from.info.extent.height >> i, 1u),
+                    .depth = std::max(from.info.extent.depth >> i, 1u),
+                },
+            });
+        }
+        commandBuffer.copyImage(from.image.get(), layout::eTransferSrcOptimal, to.image.get(), layout::eTransferDstOptimal, regions);
+        const auto postCopyBarriers = std::to_array({
+            barrier(from.image.get(), layout::eTransferSrcOptimal, layout::eShaderReadOnlyOptimal, access::eNone, access::eShaderRead),
+            barrier(to.image.get(), layout::eTransferDstOptimal, layout::eShaderReadOnlyOptimal, access::eTransferWrite, access::eShaderRead),
+        });
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eFragmentShader,
+            {},
+            nullptr,
+            nullptr,
+            postCopyBarriers
+        );
+        return vlk->uploads->currentTicket();
+    }
+
+    // Starts copies of resources in evacuated blocks, returns the number of bytes scheduled
+    vk::DeviceSize scheduleRelocations(const GraphicsContext* vlk, auto& relocations, const auto& vec, vk::DeviceSize maxBytes) {
+        vk::DeviceSize ret = 0;
+        for (const auto& resource : vec) {
+            if (ret >= maxBytes) { break; }
+            if (!vlk->allocator->isEvacuating(resource.memory) || isRelocating(handleOf(resource), relocations)) { continue; }
+            auto& relocation = relocations.emplace_back();
+            relocation.from = handleOf(resource);
+            relocation.ticket = relocate(vlk, resource, relocation.to);
+            ret += resource.memory.size();
+        }
+        return ret;
+    }
+
 public:
-    auto store(vk::UniqueDeviceMemory resource) { return storeImpl(std::move(resource), memory); }
-    auto store(vk::UniqueBuffer resource) { return storeImpl(std::move(resource), buffers); }
-    auto store(vk::UniqueImage resource) { return storeImpl(std::move(resource), images); }
+    auto store(BufferResource resource) { return storeImpl(std::move(resource), buffers); }
+    auto store(ImageResource resource) { return storeImpl(std::move(resource), images); }
     auto store(vk::UniqueImageView resource) { return storeImpl(std::move(resource), imageViews); }
     auto store(vk::UniqueSampler resource) { return storeImpl(std::move(resource), samplers); }
     auto storeTuple(auto&& resourcesTuple) {
         return std::apply([this](auto... args) { return std::make_tuple(this->store(std::move(args))...); }, std::forward<decltype(resourcesTuple)>(resourcesTuple));
     }
-};
 
+    // Hands a resource over to `deletionQueue`, it is destroyed once in-flight frames stop using it
+    void release(vk::Buffer resource, DeletionQueue& deletionQueue) { releaseImpl(resource, buffers, deletionQueue); }
+    void release(vk::Image resource, DeletionQueue& deletionQueue) { releaseImpl(resource, images, deletionQueue); }
+    void release(vk::ImageView resource, DeletionQueue& deletionQueue) { releaseImpl(resource, imageViews, deletionQueue); }
+    void release(vk::Sampler resource, DeletionQueue& deletionQueue) { releaseImpl(resource, samplers, deletionQueue); }
+
+    // Called once a moved resource is in place, with the old and the new handle.
+    // Handles to the old resource stay valid until the frames using them finish,
+    // descriptor sets referring to it have to be replaced here.
+    std::function<void(vk::Buffer, vk::Buffer)> onRelocateBuffer;
+    std::function<void(vk::Image, vk::Image)> onRelocateImage;
+
+    // One step of incremental compaction, meant to be called once per frame before recording.
+    // Moves up to `maxBytes` of buffers and images out of the emptiest sparsely used memory block
+    // with GPU copies; the block is freed when the last of them is swapped in on a later call.
+    // Callbacks run here; frames in flight may still use old descriptor sets, so replace them instead of rewriting.
+    void compact(const GraphicsContext* vlk, vk::DeviceSize maxBytes, float maxOccupancy = 0.5f) {
+        finishRelocations(vlk, bufferRelocations, buffers, onRelocateBuffer);
+        finishRelocations(vlk, imageRelocations, images, onRelocateImage);
+        if (!vlk->allocator->beginEvacuation(maxOccupancy)) { return; }
+        vk::DeviceSize scheduled = scheduleRelocations(vlk, bufferRelocations, buffers, maxBytes);
+        scheduled += scheduleRelocations(vlk, imageRelocations, images, maxBytes - std::min(scheduled, maxBytes));
+        if (scheduled == 0 && bufferRelocations.empty() && imageRelocations.empty()) {
+            // Whatever is left in the block isn't ours to move
+            vlk->allocator->endEvacuation();
+        }
+    }
+};
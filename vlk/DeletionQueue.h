@@ -0,0 +1,76 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "QueueTimeline.h"
+
+// Keeps released GPU resources alive until every submission that could still use them has finished.
+// Anything movable can be pushed: vk::Unique* handles, allocations, whole resource structs.
+// A resource is released while a frame is recorded, so it is tagged with the graphics timeline value
+// of that frame's submission, the last one that can use it, and destroyed once the timeline reaches it.
+class DeletionQueue {
+    struct Entry {
+        uint64_t timelineValue;
+        std::shared_ptr<void> resource;
+    };
+    QueueTimeline* timeline;
+    std::vector<std::shared_ptr<void>> unsubmitted; // Until the next frame is submitted
+    std::deque<Entry> entries; // In timeline order
+    std::mutex mutex;
+
+public:
+    explicit DeletionQueue(QueueTimeline* graphicsTimeline) : timeline(graphicsTimeline) {}
+
+    template <typename T>
+    void push(T resource) {
+        auto holder = std::make_shared<T>(std::move(resource));
+        std::scoped_lock lock(mutex);
+        unsubmitted.push_back(std::move(holder));
+    }
+
+    // Runs `fn` once in-flight frames are done, for resources without an owning handle
+    void defer(std::function<void()> fn) {
+        push(std::shared_ptr<void>(nullptr, [fn = std::move(fn)](void*) { fn(); }));
+    }
+
+    // Called with the timeline value of each frame's submission, it covers everything released so far
+    void submitted(uint64_t timelineValue) {
+        std::scoped_lock lock(mutex);
+        for (auto& e : unsubmitted) {
+            entries.push_back({
+                .timelineValue = timelineValue,
+                .resource = std::move(e),
+            });
+        }
+        unsubmitted.clear();
+    }
+
+    // Destroys what the GPU is done with, called when a frame starts recording
+    void collect() {
+        std::deque<Entry> expired;
+        {
+            std::scoped_lock lock(mutex);
+            while (!entries.empty() && timeline->isComplete(entries.front().timelineValue)) {
+                expired.push_back(std::move(entries.front()));
+                entries.pop_front();
+            }
+        }
+        // Destroyed here, outside the lock
+    }
+
+    // Destroys everything, only once the device is idle
+    void clear() {
+        std::deque<Entry> expired;
+        std::vector<std::shared_ptr<void>> expiredUnsubmitted;
+        std::scoped_lock lock(mutex);
+        std::swap(entries, expired);
+        std::swap(unsubmitted, expiredUnsubmitted);
+    }
+
+    size_t size() {
+        std::scoped_lock lock(mutex);
+        return unsubmitted.size() + entries.size();
+    }
+};
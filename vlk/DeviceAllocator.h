@@ -0,0 +1,416 @@
+#pragma once
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <ex.h>
+
+class DeviceAllocator;
+
+// What an allocation is used for, for accounting only
+enum class MemoryCategory : uint8_t {
+    mesh,
+    texture,
+    attachment,
+    staging,
+    uniform,
+    readback,
+    count,
+};
+constexpr auto memoryCategoryNames = std::to_array<std::string_view>({
+    "mesh",
+    "texture",
+    "attachment",
+    "staging",
+    "uniform",
+    "readback",
+});
+static_assert(memoryCategoryNames.size() == static_cast<size_t>(MemoryCategory::count));
+// Owned by AssetPool, which can move them to other memory.
+// Meshes live in GeometryPool's shared buffers, which never move: their blocks are pinned
+constexpr bool isRelocatable(MemoryCategory category) {
+    return category == MemoryCategory::texture;
+}
+
+// One vkAllocateMemory call, split into ranges by DeviceAllocator
+struct DeviceMemoryBlock {
+    vk::UniqueDeviceMemory memory;
+    vk::DeviceSize size;
+    void* mapping;
+    uint32_t memoryType;
+    bool linear;    // Buffers and linear images never share a block with optimal images
+    bool dedicated; // Holds exactly one allocation, freed with it
+    bool deviceAddress; // Allocated with eDeviceAddress, only buffers with eShaderDeviceAddress usage go here
+    std::map<vk::DeviceSize, vk::DeviceSize> freeRanges; // offset -> size
+    vk::DeviceSize usedBytes = 0;
+    size_t allocationCount = 0;
+    size_t pinnedCount = 0;  // Allocations that can't be relocated
+    bool evacuating = false; // Takes no new allocations, freed once empty
+};
+
+// Range of a DeviceMemoryBlock, returned to its allocator on destruction
+class DeviceAllocation {
+    friend class DeviceAllocator;
+    DeviceAllocator* allocator = nullptr;
+    DeviceMemoryBlock* block = nullptr;
+    vk::DeviceSize offset_ = 0;
+    vk::DeviceSize size_ = 0;
+    MemoryCategory category_ = {};
+    DeviceAllocation(DeviceAllocator* allocator, DeviceMemoryBlock* block, vk::DeviceSize offset, vk::DeviceSize size, MemoryCategory category)
+        : allocator(allocator), block(block), offset_(offset), size_(size), category_(category) {}
+public:
+    DeviceAllocation() = default;
+    DeviceAllocation(DeviceAllocation&& o)
+        : allocator(std::exchange(o.allocator, nullptr)), block(std::exchange(o.block, nullptr)),
+          offset_(o.offset_), size_(o.size_), category_(o.category_) {}
+    DeviceAllocation& operator=(DeviceAllocation&& o) {
+        if (this != &o) {
+            reset();
+            allocator = std::exchange(o.allocator, nullptr);
+            block = std::exchange(o.block, nullptr);
+            offset_ = o.offset_;
+            size_ = o.size_;
+            category_ = o.category_;
+        }
+        return *this;
+    }
+    ~DeviceAllocation() { reset(); }
+    inline void reset();
+
+    vk::DeviceMemory memory() const { return block ? block->memory.get() : vk::DeviceMemory{}; }
+    vk::DeviceSize offset() const { return offset_; }
+    vk::DeviceSize size() const { return size_; }
+    MemoryCategory category() const { return category_; }
+    // Of the memory type the range was allocated from
+    inline vk::MemoryPropertyFlags memoryProperties() const;
+    // Persistent mapping of this range, nullptr if memory is not host visible
+    void* mapping() const { return block && block->mapping ? static_cast<std::byte*>(block->mapping) + offset_ : nullptr; }
+    explicit operator bool() const { return block != nullptr; }
+};
+
+class DeviceAllocator {
+public:
+    struct Stats {
+        size_t blockCount = 0;
+        size_t allocationCount = 0;
+        size_t deviceAllocationCalls = 0; // Total vkAllocateMemory calls made
+        vk::DeviceSize allocatedBytes = 0; // Sum of block sizes
+        vk::DeviceSize usedBytes = 0;      // Sum of live allocation sizes
+        vk::DeviceSize peakAllocatedBytes = 0;
+    };
+    struct CategoryStats {
+        size_t allocationCount = 0;
+        vk::DeviceSize bytes = 0;
+    };
+    struct HeapStats {
+        vk::DeviceSize size = 0;
+        vk::DeviceSize blockBytes = 0; // Allocated from this heap by us
+        std::array<CategoryStats, static_cast<size_t>(MemoryCategory::count)> categories = {};
+        // From VK_EXT_memory_budget, includes other processes. Zero if unavailable.
+        vk::DeviceSize budget = 0;
+        vk::DeviceSize usage = 0;
+    };
+
+private:
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    vk::DeviceSize bufferImageGranularity;
+    bool memoryBudget;
+    std::vector<std::unique_ptr<DeviceMemoryBlock>> blocks;
+    Stats stats_;
+    std::vector<HeapStats> heapStats_;
+    mutable std::mutex mutex;
+
+    uint32_t heapIndex(uint32_t memoryType) const {
+        return memoryProperties.memoryTypes[memoryType].heapIndex;
+    }
+
+    static vk::DeviceSize alignUp(vk::DeviceSize v, vk::DeviceSize alignment) {
+        return (v + alignment - 1) / alignment * alignment;
+    }
+
+    vk::DeviceSize preferredBlockSize(uint32_t memoryType) const {
+        constexpr vk::DeviceSize maxBlockSize = 64 << 20;
+        const auto heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+        return std::min(maxBlockSize, heapSize / 8);
+    }
+
+    DeviceMemoryBlock* allocateBlock(uint32_t memoryType, vk::DeviceSize size, bool linear, bool dedicated, bool deviceAddress) {
+        const vk::MemoryAllocateFlagsInfo flagsInfo = {
+            .flags = vk::MemoryAllocateFlagBits::eDeviceAddress,
+            .deviceMask = 0,
+        };
+        auto block = std::make_unique<DeviceMemoryBlock>(DeviceMemoryBlock {
+            .memory = device.allocateMemoryUnique({
+                .pNext = deviceAddress ? &flagsInfo : nullptr,
+                .allocationSize = size,
+                .memoryTypeIndex = memoryType,
+            }),
+            .size = size,
+            .mapping = nullptr,
+            .memoryType = memoryType,
+            .linear = linear,
+            .dedicated = dedicated,
+            .deviceAddress = deviceAddress,
+            .freeRanges = {{0, size}},
+        });
+        if (memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+            block->mapping = device.mapMemory(block->memory.get(), 0, VK_WHOLE_SIZE, {});
+        }
+        stats_.blockCount++;
+        stats_.deviceAllocationCalls++;
+        stats_.allocatedBytes += size;
+        stats_.peakAllocatedBytes = std::max(stats_.peakAllocatedBytes, stats_.allocatedBytes);
+        heapStats_[heapIndex(memoryType)].blockBytes += size;
+        blocks.push_back(std::move(block));
+        return blocks.back().get();
+    }
+
+    void freeBlock(DeviceMemoryBlock* block) {
+        const auto it = std::ranges::find_if(blocks, [block](const auto& e) { return e.get() == block; });
+        assert(it != blocks.end());
+        stats_.blockCount--;
+        stats_.allocatedBytes -= block->size;
+        heapStats_[heapIndex(block->memoryType)].blockBytes -= block->size;
+        blocks.erase(it);
+    }
+
+    // First fit inside the free ranges of one block
+    static std::optional<vk::DeviceSize> tryAllocate(DeviceMemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment) {
+        for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+            const auto [rangeOffset, rangeSize] = *it;
+            const auto offset = alignUp(rangeOffset, alignment);
+            if (offset + size > rangeOffset + rangeSize) { continue; }
+            block.freeRanges.erase(it);
+            if (offset != rangeOffset) {
+                block.freeRanges.emplace(rangeOffset, offset - rangeOffset);
+            }
+            if (offset + size != rangeOffset + rangeSize) {
+                block.freeRanges.emplace(offset + size, rangeOffset + rangeSize - offset - size);
+            }
+            block.usedBytes += size;
+            block.allocationCount++;
+            return offset;
+        }
+        return std::nullopt;
+    }
+
+    // Accounts for a range once it was allocated, allocateBlock() may throw before
+    DeviceAllocation track(DeviceMemoryBlock* block, vk::DeviceSize offset, vk::DeviceSize size, MemoryCategory category) {
+        stats_.allocationCount++;
+        stats_.usedBytes += size;
+        auto& categoryStats = heapStats_[heapIndex(block->memoryType)].categories[static_cast<size_t>(category)];
+        categoryStats.allocationCount++;
+        categoryStats.bytes += size;
+        block->pinnedCount += !isRelocatable(category);
+        return DeviceAllocation(this, block, offset, size, category);
+    }
+
+public:
+    // memoryBudget: VK_EXT_memory_budget is enabled
+    DeviceAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, bool memoryBudget)
+        : physicalDevice(physicalDevice),
+          device(device),
+          memoryProperties(physicalDevice.getMemoryProperties()),
+          bufferImageGranularity(physicalDevice.getProperties().limits.bufferImageGranularity),
+          memoryBudget(memoryBudget)
+    {
+        heapStats_.resize(memoryProperties.memoryHeapCount);
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            heapStats_[i].size = memoryProperties.memoryHeaps[i].size;
+        }
+    }
+    DeviceAllocator(const DeviceAllocator&) = delete;
+    DeviceAllocator& operator=(const DeviceAllocator&) = delete;
+
+    const vk::PhysicalDeviceMemoryProperties& properties() const { return memoryProperties; }
+
+    // Device-local requests take the matching type on the largest heap, the first one on ties: host-visible
+    // device-local types may also exist on a small BAR window, which zero-copy detection rules out
+    uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags requiredProperties) const {
+        std::optional<uint32_t> ret;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if (
+                !(typeFilter & (1 << i)) ||
+                (memoryProperties.memoryTypes[i].propertyFlags & requiredProperties) != requiredProperties
+            ) {
+                continue;
+            }
+            if (!(requiredProperties & vk::MemoryPropertyFlagBits::eDeviceLocal)) { return i; }
+            const auto heapSize = [this](uint32_t type) { return memoryProperties.memoryHeaps[heapIndex(type)].size; };
+            if (!ret || heapSize(i) > heapSize(*ret)) { ret = i; }
+        }
+        if (!ret) { throw ex::runtime("couldn't find suitable memory type"); }
+        return *ret;
+    }
+
+    // linear: the resource is a buffer or a linear-tiling image.
+    // Linear and optimal resources live in separate blocks, so bufferImageGranularity
+    // only has to be respected between blocks, not between neighbouring ranges.
+    // deviceAddress: for buffers with eShaderDeviceAddress usage, they get blocks allocated with eDeviceAddress
+    DeviceAllocation allocate(
+        const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, bool linear, MemoryCategory category, bool deviceAddress = false
+    ) {
+        const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        const auto alignment = std::max<vk::DeviceSize>(requirements.alignment, 1);
+        const auto blockSize = preferredBlockSize(memoryType);
+        std::scoped_lock lock(mutex);
+        // Lazily allocated memory is only committed as the GPU touches it, its blocks aren't shared
+        if (requirements.size > blockSize / 2 || (properties & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+            auto* block = allocateBlock(memoryType, requirements.size, linear, true, deviceAddress);
+            block->freeRanges.clear();
+            block->usedBytes = requirements.size;
+            block->allocationCount = 1;
+            return track(block, 0, requirements.size, category);
+        }
+        for (const auto& block : blocks) {
+            if (block->dedicated || block->evacuating || block->memoryType != memoryType || block->linear != linear || block->deviceAddress != deviceAddress) { continue; }
+            if (const auto offset = tryAllocate(*block, requirements.size, alignment)) {
+                return track(block.get(), *offset, requirements.size, category);
+            }
+        }
+        auto* block = allocateBlock(memoryType, alignUp(blockSize, bufferImageGranularity), linear, false, deviceAddress);
+        const auto offset = tryAllocate(*block, requirements.size, alignment);
+        assert(offset.has_value());
+        return track(block, *offset, requirements.size, category);
+    }
+
+    void free(DeviceMemoryBlock* block, vk::DeviceSize offset, vk::DeviceSize size, MemoryCategory category) {
+        std::scoped_lock lock(mutex);
+        stats_.allocationCount--;
+        stats_.usedBytes -= size;
+        auto& categoryStats = heapStats_[heapIndex(block->memoryType)].categories[static_cast<size_t>(category)];
+        categoryStats.allocationCount--;
+        categoryStats.bytes -= size;
+        block->usedBytes -= size;
+        block->allocationCount--;
+        block->pinnedCount -= !isRelocatable(category);
+        if (block->dedicated || (block->evacuating && block->allocationCount == 0)) {
+            freeBlock(block);
+            return;
+        }
+        // Insert the range and merge it with its neighbours
+        auto it = block->freeRanges.emplace(offset, size).first;
+        if (const auto next = std::next(it); next != block->freeRanges.end() && offset + size == next->first) {
+            it->second += next->second;
+            block->freeRanges.erase(next);
+        }
+        if (it != block->freeRanges.begin()) {
+            const auto prev = std::prev(it);
+            if (prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                block->freeRanges.erase(it);
+            }
+        }
+        // Keep at most one empty block per memory type around for reuse
+        if (block->allocationCount == 0) {
+            const bool haveOtherEmpty = std::ranges::any_of(blocks, [block](const auto& e) {
+                return e.get() != block && !e->dedicated && e->allocationCount == 0 &&
+                       e->memoryType == block->memoryType && e->linear == block->linear && e->deviceAddress == block->deviceAddress;
+            });
+            if (haveOtherEmpty) {
+                freeBlock(block);
+            }
+        }
+    }
+
+    // Marks the emptiest shared block that is less than `maxOccupancy` full for evacuation,
+    // unless one already is. Only blocks holding relocatable allocations alone qualify, and
+    // only if the other blocks of their memory type have room for them: relocations that
+    // needed a new block would leave a sparse block behind and start over.
+    // Returns whether a block is being evacuated.
+    bool beginEvacuation(float maxOccupancy) {
+        std::scoped_lock lock(mutex);
+        if (std::ranges::any_of(blocks, [](const auto& e) { return e->evacuating; })) { return true; }
+        DeviceMemoryBlock* best = nullptr;
+        for (const auto& block : blocks) {
+            if (block->dedicated || block->allocationCount == 0 || block->pinnedCount != 0) { continue; }
+            if (block->usedBytes >= block->size * maxOccupancy) { continue; }
+            vk::DeviceSize siblingFreeBytes = 0;
+            for (const auto& e : blocks) {
+                if (e == block || e->dedicated || e->memoryType != block->memoryType || e->linear != block->linear ||
+                    e->deviceAddress != block->deviceAddress) { continue; }
+                siblingFreeBytes += e->size - e->usedBytes;
+            }
+            if (siblingFreeBytes >= block->usedBytes && (!best || block->usedBytes < best->usedBytes)) {
+                best = block.get();
+            }
+        }
+        if (best) { best->evacuating = true; }
+        return best != nullptr;
+    }
+
+    // Gives up on blocks that still hold allocations, they take new ones again
+    void endEvacuation() {
+        std::scoped_lock lock(mutex);
+        for (const auto& block : blocks) { block->evacuating = false; }
+    }
+
+    bool isEvacuating(const DeviceAllocation& allocation) const {
+        std::scoped_lock lock(mutex);
+        return allocation.block && allocation.block->evacuating;
+    }
+
+    Stats stats() const {
+        std::scoped_lock lock(mutex);
+        return stats_;
+    }
+
+    // Per heap accounting, with the current budget if VK_EXT_memory_budget is enabled
+    std::vector<HeapStats> heapStats() const {
+        auto ret = [&] {
+            std::scoped_lock lock(mutex);
+            return heapStats_;
+        }();
+        if (memoryBudget) {
+            const auto properties = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+            const auto& budget = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+            for (size_t i = 0; i < ret.size(); i++) {
+                ret[i].budget = budget.heapBudget[i];
+                ret[i].usage = budget.heapUsage[i];
+            }
+        }
+        return ret;
+    }
+
+    void printStats() const {
+        const auto s = stats();
+        prn_raw("Device memory: ", s.allocationCount, " allocations in ", s.blockCount, " blocks, ",
+                s.deviceAllocationCalls, " vkAllocateMemory calls, ",
+                s.usedBytes >> 10, " KiB used of ", s.allocatedBytes >> 10, " KiB (peak ", s.peakAllocatedBytes >> 10, " KiB)");
+        const auto heaps = heapStats();
+        for (size_t i = 0; i < heaps.size(); i++) {
+            const auto& heap = heaps[i];
+            if (heap.blockBytes == 0 && heap.usage == 0) { continue; }
+            if (memoryBudget) {
+                prn_raw("\tHeap ", i, ": ", heap.blockBytes >> 10, " KiB in blocks, usage ", heap.usage >> 10, " KiB of ", heap.budget >> 10, " KiB budget");
+            } else {
+                prn_raw("\tHeap ", i, ": ", heap.blockBytes >> 10, " KiB in blocks of ", heap.size >> 10, " KiB");
+            }
+            for (size_t c = 0; c < heap.categories.size(); c++) {
+                if (heap.categories[c].allocationCount == 0) { continue; }
+                prn_raw("\t\t", memoryCategoryNames[c], ": ", heap.categories[c].allocationCount, " allocations, ", heap.categories[c].bytes >> 10, " KiB");
+            }
+        }
+    }
+};
+
+inline vk::MemoryPropertyFlags DeviceAllocation::memoryProperties() const {
+    return block ? allocator->properties().memoryTypes[block->memoryType].propertyFlags : vk::MemoryPropertyFlags{};
+}
+
+inline void DeviceAllocation::reset() {
+    if (allocator) {
+        allocator->free(block, offset_, size_, category_);
+        allocator = nullptr;
+        block = nullptr;
+    }
+}
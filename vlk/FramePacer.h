@@ -0,0 +1,194 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include "GraphicsContext.h"
+
+// Measures CPU and GPU frame times of a render target and, when enabled,
+// delays the start of the next frame (input sampling and recording)
+// so that it is submitted just before the GPU runs out of queued work.
+// GPU time comes from timestamps written by two tiny command buffers
+// that are submitted around each frame's own.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Exponential moving averages, in ms
+    struct Metrics {
+        double cpuTime = 0;   // Recording, from the end of startFrame() to submit
+        double gpuTime = 0;   // First to last command of a frame on the GPU, after its swapchain image is available. 0 without timestamp support
+        double waitTime = 0;  // Blocked in startFrame() on earlier frames and image acquisition
+        double sleepTime = 0; // Delay added by pacing
+        double interval = 0;  // Between frame starts, the reciprocal of throughput
+        double latency = 0;   // From the start of a frame (after input sampling) until its completion was observed
+    };
+
+    bool enabled = false;
+    // Slack kept between predicted GPU idle and the next submit, absorbs jitter
+    double marginMs = 1.0;
+
+private:
+    const GraphicsContext* vlk;
+    vk::UniqueQueryPool queryPool;
+    double timestampPeriodMs = 0;
+    vk::UniqueCommandPool commandPool;
+    struct Slot {
+        vk::UniqueCommandBuffer beginCommandBuffer;
+        vk::UniqueCommandBuffer endCommandBuffer;
+        uint64_t timelineValue = 0; // On the graphics timeline
+        Clock::time_point start;
+        Clock::time_point recordStart;
+        bool pending = false;    // Submitted, completion not observed yet
+        bool hasQueries = false; // Timestamps were written by the last submit
+    };
+    std::vector<Slot> slots;
+    Metrics metrics_;
+    Clock::time_point lastStart;
+    Clock::time_point waitStart;
+    uint64_t frameCount = 0;
+
+    static constexpr double smoothing = 0.1;
+    static void accumulate(double& average, double sample) {
+        average = average == 0 ? sample : average + (sample - average) * smoothing;
+    }
+    static double elapsedMs(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    void observeCompletion(Slot& slot, Clock::time_point now) {
+        if (!slot.pending) { return; }
+        if (!vlk->graphicsTimeline->isComplete(slot.timelineValue)) { return; }
+        slot.pending = false;
+        accumulate(metrics_.latency, elapsedMs(slot.start, now));
+    }
+
+    void pollCompletions() {
+        const auto now = Clock::now();
+        for (auto& slot : slots) {
+            observeCompletion(slot, now);
+        }
+    }
+
+    void readTimestamps(uint32_t slotIndex) {
+        auto& slot = slots[slotIndex];
+        if (!slot.hasQueries) { return; }
+        slot.hasQueries = false;
+        std::array<uint64_t, 2> timestamps;
+        const vk::Result res = vlk->device->getQueryPoolResults(
+            queryPool.get(), slotIndex * 2, 2,
+            sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64
+        );
+        if (res != vk::Result::eSuccess) { return; }
+        accumulate(metrics_.gpuTime, (timestamps[1] - timestamps[0]) * timestampPeriodMs);
+    }
+
+    void recordTimestamp(vk::CommandBuffer commandBuffer, uint32_t query, vk::PipelineStageFlagBits stage, bool reset) {
+        commandBuffer.begin({
+            .flags = {},
+            .pInheritanceInfo = nullptr,
+        });
+        if (reset) {
+            commandBuffer.resetQueryPool(queryPool.get(), query, 2);
+        }
+        commandBuffer.writeTimestamp(stage, queryPool.get(), query);
+        commandBuffer.end();
+    }
+
+public:
+    FramePacer(const GraphicsContext* vlk, uint32_t framesInFlight) : vlk(vlk), slots(framesInFlight) {
+        const auto& family = vlk->props.queueFamilyProperties[vlk->props.graphicsQueueFamily];
+        if (family.timestampValidBits == 0) {
+            prn("GPU timestamps unsupported, frame pacing uses CPU times only");
+            return;
+        }
+        timestampPeriodMs = vlk->props.deviceProperties.limits.timestampPeriod * 1e-6;
+        queryPool = vlk->device->createQueryPoolUnique({
+            .flags = {},
+            .queryType = vk::QueryType::eTimestamp,
+            .queryCount = framesInFlight * 2,
+            .pipelineStatistics = {},
+        });
+        commandPool = vlk->device->createCommandPoolUnique({
+            .flags = {},
+            .queueFamilyIndex = vlk->props.graphicsQueueFamily,
+        });
+        auto commandBuffers = vlk->device->allocateCommandBuffersUnique({
+            .commandPool = commandPool.get(),
+            .level = vk::CommandBufferLevel::ePrimary,
+            .commandBufferCount = framesInFlight * 2,
+        });
+        // Recorded once, a slot is resubmitted only after its previous submit completed
+        for (uint32_t i = 0; i < framesInFlight; i++) {
+            auto& slot = slots[i];
+            slot.beginCommandBuffer = std::move(commandBuffers[i * 2]);
+            slot.endCommandBuffer = std::move(commandBuffers[i * 2 + 1]);
+            // Frames wait for their swapchain image at this stage, so that wait isn't counted
+            recordTimestamp(slot.beginCommandBuffer.get(), i * 2, vk::PipelineStageFlagBits::eColorAttachmentOutput, true);
+            recordTimestamp(slot.endCommandBuffer.get(), i * 2 + 1, vk::PipelineStageFlagBits::eBottomOfPipe, false);
+        }
+    }
+
+    // Call before sampling input for the next frame.
+    // Sleeps until the previous frame is predicted to finish on the GPU, minus this frame's CPU time.
+    void wait() {
+        pollCompletions();
+        if (!enabled || frameCount < slots.size()) { return; }
+        // The previous frame completes about `latency` after it started, and the GPU can't take frames faster than `gpuTime`.
+        // Starting earlier only lengthens the queue; the margin lets the queue settle at about marginMs.
+        const double delay = std::max(metrics_.latency - metrics_.cpuTime, metrics_.gpuTime) - marginMs;
+        const auto target = lastStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(delay));
+        const auto sleepStart = Clock::now();
+        // Short steps, so completions are observed close to when they happen
+        while (Clock::now() < target) {
+            std::this_thread::sleep_until(std::min(target, Clock::now() + std::chrono::microseconds(500)));
+            pollCompletions();
+        }
+        accumulate(metrics_.sleepTime, elapsedMs(sleepStart, Clock::now()));
+    }
+
+    // Called by the render target, before waiting for the slot's previous frame
+    void beginWait() {
+        waitStart = Clock::now();
+    }
+
+    // Called by the render target once the slot's previous frame completed and, for a swapchain, an image was acquired
+    void frameStarted(uint32_t slotIndex) {
+        const auto now = Clock::now();
+        auto& slot = slots[slotIndex];
+        observeCompletion(slot, now);
+        slot.pending = false;
+        readTimestamps(slotIndex);
+        accumulate(metrics_.waitTime, elapsedMs(waitStart, now));
+        if (frameCount != 0) {
+            accumulate(metrics_.interval, elapsedMs(lastStart, waitStart));
+        }
+        lastStart = waitStart;
+        slot.start = waitStart;
+        slot.recordStart = now;
+        frameCount++;
+    }
+
+    // What to submit for a frame: its command buffer, surrounded by timestamp writes when supported
+    std::vector<vk::CommandBuffer> submittedCommandBuffers(uint32_t slotIndex, vk::CommandBuffer frameCommandBuffer) const {
+        if (!queryPool) { return {frameCommandBuffer}; }
+        return {slots[slotIndex].beginCommandBuffer.get(), frameCommandBuffer, slots[slotIndex].endCommandBuffer.get()};
+    }
+
+    // Called by the render target right after submitting, with the graphics timeline value the frame signals
+    void frameSubmitted(uint32_t slotIndex, uint64_t timelineValue) {
+        auto& slot = slots[slotIndex];
+        slot.timelineValue = timelineValue;
+        slot.pending = true;
+        slot.hasQueries = bool(queryPool);
+        accumulate(metrics_.cpuTime, elapsedMs(slot.recordStart, Clock::now()));
+    }
+
+    const Metrics& metrics() const { return metrics_; }
+
+    void printMetrics() const {
+        prn_raw("Frame pacing ", enabled ? "on" : "off", ": ",
+                metrics_.interval, " ms interval (", metrics_.interval ? 1000 / metrics_.interval : 0, " fps), ",
+                metrics_.latency, " ms latency, cpu ", metrics_.cpuTime, " ms, gpu ", metrics_.gpuTime,
+                " ms, waited ", metrics_.waitTime, " ms, slept ", metrics_.sleepTime, " ms");
+    }
+};
@@ -0,0 +1,231 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "GraphicsContext.h"
+#include "utils.h"
+
+// Copies finished frames into a ring of host-visible buffers and hands them to a callback
+// once the GPU is done with them. Never waits on the GPU: when every buffer is still
+// in flight or being consumed, the capture is dropped.
+// The callback runs on a worker thread, or in poll() without one.
+class FrameReadback {
+public:
+    struct CapturedFrame {
+        uint64_t frame;
+        vk::Extent2D extent;
+        vk::Format format;
+        std::span<const std::byte> pixels; // Tightly packed rows, 4 bytes per pixel
+    };
+
+private:
+    const GraphicsContext* vlk;
+    struct Slot {
+        vk::UniqueBuffer buffer;
+        DeviceAllocation memory;
+        vk::DeviceSize capacity = 0;
+        CapturedFrame frame;
+        uint64_t timelineValue = 0; // 0 until submitted() for the frame that copies into it
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> inFlight; // In recording order
+    std::function<void(const CapturedFrame&)> callback;
+    uint64_t dropped_ = 0;
+
+    // Shared with the worker
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<uint32_t> completed;
+    std::vector<uint32_t> consumed;
+    bool stopping = false;
+    std::thread worker;
+
+    static constexpr uint32_t bytesPerPixel = 4;
+
+    void reserve(Slot& slot, vk::DeviceSize size) {
+        if (slot.capacity >= size) { return; }
+        using mem = vk::MemoryPropertyFlagBits;
+        // Cached memory is much faster for the CPU to read
+        const auto& memoryProperties = vlk->allocator->properties();
+        const bool hasCached = std::ranges::any_of(
+            std::span(memoryProperties.memoryTypes.data(), memoryProperties.memoryTypeCount),
+            [](const vk::MemoryType& type) {
+                const auto required = mem::eHostVisible | mem::eHostCoherent | mem::eHostCached;
+                return (type.propertyFlags & required) == required;
+            }
+        );
+        const vk::MemoryPropertyFlags properties = mem::eHostVisible | mem::eHostCoherent | (hasCached ? mem::eHostCached : vk::MemoryPropertyFlags{});
+        slot.buffer.reset();
+        slot.memory = {};
+        std::tie(slot.buffer, slot.memory) = vlk->createBuffer(size, vk::BufferUsageFlagBits::eTransferDst, properties, MemoryCategory::readback);
+        slot.capacity = size;
+    }
+
+    void runWorker() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || !completed.empty(); });
+            if (completed.empty()) { return; }
+            const uint32_t i = completed.front();
+            completed.pop_front();
+            lock.unlock();
+            callback(slots[i].frame);
+            lock.lock();
+            consumed.push_back(i);
+            cv.notify_all(); // For flush()
+        }
+    }
+
+public:
+    // bufferCount: captures that can be pending at once, at least the number of frames in flight to not drop any
+    FrameReadback(const GraphicsContext* vlk, uint32_t bufferCount, std::function<void(const CapturedFrame&)> callback, bool useWorkerThread = true)
+        : vlk(vlk), slots(bufferCount), callback(std::move(callback))
+    {
+        for (uint32_t i = 0; i < bufferCount; i++) {
+            freeSlots.push_back(bufferCount - 1 - i);
+        }
+        if (useWorkerThread) {
+            worker = std::thread([this] { runWorker(); });
+        }
+    }
+    FrameReadback(const FrameReadback&) = delete;
+    FrameReadback& operator=(const FrameReadback&) = delete;
+    ~FrameReadback() {
+        if (worker.joinable()) {
+            {
+                std::scoped_lock lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            worker.join();
+        }
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+    static bool supports(const RenderTarget& target) {
+        return bool(target.usage & vk::ImageUsageFlagBits::eTransferSrc) && vk::blockSize(target.format) == bytesPerPixel;
+    }
+
+    // Records a copy of `image`, which the frame left in target.finalLayout, into `commandBuffer`.
+    // Returns false if the capture was dropped. The capture isn't read before submitted() is called for it.
+    bool record(vk::CommandBuffer commandBuffer, uint64_t frame, vk::Image image, const RenderTarget& target) {
+        poll();
+        if (freeSlots.empty() || !supports(target)) {
+            dropped_++;
+            return false;
+        }
+        const uint32_t i = freeSlots.back();
+        freeSlots.pop_back();
+        auto& slot = slots[i];
+        const vk::DeviceSize size = (vk::DeviceSize) target.extent.width * target.extent.height * bytesPerPixel;
+        reserve(slot, size);
+        slot.frame = {
+            .frame = frame,
+            .extent = target.extent,
+            .format = target.format,
+            .pixels = std::span(static_cast<const std::byte*>(slot.memory.mapping()), size),
+        };
+        slot.timelineValue = 0;
+        inFlight.push_back(i);
+
+        constexpr vk::ImageSubresourceRange range = {
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+        const auto barrier = [&](vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess) {
+            return vk::ImageMemoryBarrier {
+                .srcAccessMask = srcAccess,
+                .dstAccessMask = dstAccess,
+                .oldLayout = oldLayout,
+                .newLayout = newLayout,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .image = image,
+                .subresourceRange = range,
+            };
+        };
+        using layout = vk::ImageLayout;
+        using access = vk::AccessFlagBits;
+        using stage = vk::PipelineStageFlagBits;
+        commandBuffer.pipelineBarrier(stage::eColorAttachmentOutput | stage::eTransfer, stage::eTransfer, {}, nullptr, nullptr,
+            barrier(target.finalLayout, layout::eTransferSrcOptimal, access::eColorAttachmentWrite | access::eTransferWrite, access::eTransferRead));
+        commandBuffer.copyImageToBuffer(image, layout::eTransferSrcOptimal, slot.buffer.get(), vk::BufferImageCopy {
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {target.extent.width, target.extent.height, 1},
+        });
+        commandBuffer.pipelineBarrier(stage::eTransfer, stage::eHost | stage::eAllCommands, {}, nullptr,
+            vk::BufferMemoryBarrier {
+                .srcAccessMask = access::eTransferWrite,
+                .dstAccessMask = access::eHostRead,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .buffer = slot.buffer.get(),
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            },
+            barrier(layout::eTransferSrcOptimal, target.finalLayout, access::eTransferRead, access::eMemoryRead));
+        return true;
+    }
+
+    // Call after submitting the command buffer passed to record(), with the graphics timeline value of the submission.
+    // Several captures may be recorded into one command buffer (one per view), none of them is read before this
+    void submitted(uint64_t timelineValue) {
+        for (const auto i : inFlight) {
+            if (slots[i].timelineValue == 0) { slots[i].timelineValue = timelineValue; }
+        }
+    }
+
+    // Hands finished captures over, call once per frame
+    void poll() {
+        std::vector<uint32_t> ready;
+        std::erase_if(inFlight, [&](uint32_t i) {
+            const auto& slot = slots[i];
+            if (slot.timelineValue == 0 || !vlk->graphicsTimeline->isComplete(slot.timelineValue)) { return false; }
+            ready.push_back(i);
+            return true;
+        });
+        if (!worker.joinable()) {
+            for (const auto i : ready) {
+                callback(slots[i].frame);
+                freeSlots.push_back(i);
+            }
+            return;
+        }
+        {
+            std::scoped_lock lock(mutex);
+            completed.insert(completed.end(), ready.begin(), ready.end());
+            freeSlots.insert(freeSlots.end(), consumed.begin(), consumed.end());
+            consumed.clear();
+        }
+        cv.notify_one();
+    }
+
+    // Waits for every capture to reach the callback, once nothing more will be submitted
+    void flush() {
+        for (const auto i : inFlight) {
+            assert(slots[i].timelineValue != 0);
+            vlk->graphicsTimeline->wait(slots[i].timelineValue);
+        }
+        poll();
+        if (worker.joinable()) {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this] { return completed.empty() && consumed.size() + freeSlots.size() == slots.size(); });
+        }
+    }
+};
@@ -1,5 +1,6 @@
 #pragma once
 #define VULKAN_HPP_NO_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
 #include <vulkan/vulkan.hpp>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -7,9 +8,23 @@
 #include <map>
 #include <fstream>
 #include <bit>
+#include <numeric>
 #include <ex.h>
+#include "../mipmaps.h"
+#include "DeviceAllocator.h"
+#include "QueueTimeline.h"
+#include "StagingRing.h"
+#include "UploadContext.h"
+#include "DeletionQueue.h"
+
+// Every vk:: call goes through VULKAN_HPP_DEFAULT_DISPATCHER, which createInstance() and
+// makeGraphicsContext() fill with instance and device level function pointers.
+// Device functions are then called without the loader's per-call trampoline.
+// Needs VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE in one translation unit.
+// withWindow: enable the extensions GLFW needs for a surface, glfwInit() must have been called
+inline vk::UniqueInstance createInstance(bool withWindow = true) {
+    VULKAN_HPP_DEFAULT_DISPATCHER.init();
 
-inline vk::UniqueInstance createInstance() {
     // List of required instance layers
     const auto requiredInstanceLayers = std::to_array({"VK_LAYER_KHRONOS_validation"});
     // const std::array<const char*, 0> requiredInstanceLayers;
@@ -29,7 +44,8 @@ inline vk::UniqueInstance createInstance() {
     }();
 
     // Generate a list of required instance extensions
-    const auto glfwInstanceExtensions = [] {
+    const auto glfwInstanceExtensions = [withWindow] {
+        if (!withWindow) { return std::span<const char* const>(); }
         uint32_t glfwExtensionCount = 0;
         const char** glfwExtensionsRaw;
         glfwExtensionsRaw = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
@@ -52,13 +68,13 @@ inline vk::UniqueInstance createInstance() {
     }();
 
     // Create instance
-    return [&requiredInstanceLayers, &requiredInstanceExtensions] {
+    auto instance = [&requiredInstanceLayers, &requiredInstanceExtensions] {
         const vk::ApplicationInfo appInfo = {
             .pApplicationName = "Vulkan",
             .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
             .pEngineName = "No Engine",
             .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-            .apiVersion = VK_API_VERSION_1_0,
+            .apiVersion = VK_API_VERSION_1_3,
         };
         return vk::createInstanceUnique({
             .flags = {},
@@ -69,6 +85,8 @@ inline vk::UniqueInstance createInstance() {
             .ppEnabledExtensionNames = requiredInstanceExtensions.data(),
         });
     }();
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(instance.get());
+    return instance;
 }
 
 inline vk::PhysicalDevice pickPhysicalDevice(vk::Instance instance, vk::SurfaceKHR surface, std::ranges::range auto&& requiredDeviceExtensions) {
@@ -121,6 +139,7 @@ inline vk::PhysicalDevice pickPhysicalDevice(vk::Instance instance, vk::SurfaceK
             return false;
         }();
         const bool hasPresentQueueFamily = [&] {
+            if (!surface) { return true; }
             for (uint32_t i = 0; i < queueFamilies.size(); i++) {
                 if (device.getSurfaceSupportKHR(i, surface)) {
                     return true;
@@ -128,12 +147,18 @@ inline vk::PhysicalDevice pickPhysicalDevice(vk::Instance instance, vk::SurfaceK
             }
             return false;
         }();
+        const bool supportsTimelineSemaphores = device.getProperties().apiVersion >= VK_API_VERSION_1_2 &&
+            device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>().get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore;
         return
             deviceSupportsExtensions &&
+            supportsTimelineSemaphores &&
             hasGraphicsQueueFamily &&
-            hasPresentQueueFamily &&
-            device.getSurfaceFormatsKHR(surface).size() > 0 &&
-            device.getSurfacePresentModesKHR(surface).size() > 0;
+            hasPresentQueueFamily && (
+                !surface || (
+                    device.getSurfaceFormatsKHR(surface).size() > 0 &&
+                    device.getSurfacePresentModesKHR(surface).size() > 0
+                )
+            );
     };
 
     const auto suitableDevices = [&availableDevices, &isSuitable] {
@@ -171,6 +196,18 @@ inline vk::PhysicalDevice pickPhysicalDevice(vk::Instance instance, vk::SurfaceK
     }();
 }
 
+// Long-lived device-local resources, with what's needed to recreate them in other memory
+struct BufferResource {
+    vk::UniqueBuffer buffer;
+    DeviceAllocation memory;
+    vk::BufferCreateInfo info;
+};
+struct ImageResource {
+    vk::UniqueImage image;
+    DeviceAllocation memory;
+    vk::ImageCreateInfo info; // Always ends up in eShaderReadOnlyOptimal
+};
+
 struct GraphicsContext {
     vk::Instance instance;
     vk::PhysicalDevice physicalDevice;
@@ -182,140 +219,99 @@ struct GraphicsContext {
         std::vector<vk::QueueFamilyProperties> queueFamilyProperties;
         uint32_t graphicsQueueFamily;
         uint32_t presentQueueFamily;
+        uint32_t transferQueueFamily; // Same as graphicsQueueFamily if there is no dedicated transfer family
         std::set<uint32_t> uniqueQueueFamilies;
         vk::MemoryPropertyFlags memoryProperties;
+        bool zeroCopyUploads; // Device-local memory is host visible, buffers are written in place
+        bool hostImageCopy;   // VK_EXT_host_image_copy is enabled and can write eShaderReadOnlyOptimal images
+        bool memoryBudget;    // VK_EXT_memory_budget is enabled
+        bool lazilyAllocatedMemory; // Transient attachments can be backed by memory that is never committed (tilers)
+        bool bufferDeviceAddress;   // Shaders can read buffers through 64-bit addresses, eShaderDeviceAddress buffers get eDeviceAddress memory
     } props;
     vk::UniqueDevice device;
+    std::unique_ptr<DeviceAllocator> allocator;
+    std::unique_ptr<StagingRing> stagingRing;
     vk::Queue graphicsQueue;
     vk::Queue presentQueue;
-    vk::UniqueCommandPool commandPoolUtil;
+    vk::Queue transferQueue;
+    // Signaled by every submission to the queue, see QueueTimeline
+    std::unique_ptr<QueueTimeline> graphicsTimeline;
+    std::unique_ptr<QueueTimeline> transferTimeline; // Null without a dedicated transfer family, transferQueue is then the graphics queue
+    std::unique_ptr<UploadContext> uploads;
+    // Destroyed first, entries may still hold allocations
+    std::unique_ptr<DeletionQueue> deletionQueue;
 
 
     uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags requiredProperties) const {
-        const auto memoryProperties = physicalDevice.getMemoryProperties();
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-            if (
-                (typeFilter & (1 << i)) &&
-                (memoryProperties.memoryTypes[i].propertyFlags & requiredProperties) == requiredProperties
-            ) {
-                return i;
-            }
-        }
-        throw ex::runtime("couldn't find suitable memory type");
+        return allocator->findMemoryType(typeFilter, requiredProperties);
     }
     auto createBuffer(
         size_t nBytes,
         vk::BufferUsageFlags usage,
-        vk::MemoryPropertyFlags properties
+        vk::MemoryPropertyFlags properties,
+        MemoryCategory category
     ) const {
-        auto buffer = device->createBufferUnique({
+        return createBuffer({
             .flags = {},
             .size = nBytes,
             .usage = usage,
             .sharingMode = vk::SharingMode::eExclusive,
             .queueFamilyIndexCount = 0,
             .pQueueFamilyIndices = nullptr,
-        });
-        auto memoryRequirements = device->getBufferMemoryRequirements(buffer.get());
-        auto memory = device->allocateMemoryUnique({
-            .allocationSize = memoryRequirements.size,
-            .memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties),
-        });
-        device->bindBufferMemory(buffer.get(), memory.get(), 0);
+        }, properties, category);
+    }
+    auto createBuffer(
+        const vk::BufferCreateInfo& createInfo,
+        vk::MemoryPropertyFlags properties,
+        MemoryCategory category
+    ) const {
+        auto buffer = device->createBufferUnique(createInfo);
+        const bool deviceAddress = bool(createInfo.usage & vk::BufferUsageFlagBits::eShaderDeviceAddress);
+        auto memory = allocator->allocate(device->getBufferMemoryRequirements(buffer.get()), properties, true, category, deviceAddress);
+        device->bindBufferMemory(buffer.get(), memory.memory(), memory.offset());
         return std::pair(std::move(buffer), std::move(memory));
     }
     auto createImage(
         const vk::ImageCreateInfo& createInfo,
-        vk::MemoryPropertyFlags memoryProperties
+        vk::MemoryPropertyFlags memoryProperties,
+        MemoryCategory category
     ) const {
         auto image = device->createImageUnique(createInfo);
-        auto memoryRequirements = device->getImageMemoryRequirements(image.get());
-        auto memory = device->allocateMemoryUnique({
-            .allocationSize = memoryRequirements.size,
-            .memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, memoryProperties),
-        });
-        device->bindImageMemory(image.get(), memory.get(), 0);
+        const bool linear = createInfo.tiling == vk::ImageTiling::eLinear;
+        auto memory = allocator->allocate(device->getImageMemoryRequirements(image.get()), memoryProperties, linear, category);
+        device->bindImageMemory(image.get(), memory.memory(), memory.offset());
         return std::pair(std::move(image), std::move(memory));
     }
-    void fillBuffer(const vk::UniqueDeviceMemory& memory, const auto& data) const {
+    void fillBuffer(const DeviceAllocation& memory, const auto& data) const {
         std::span bytes = data;
-        void* mapped = device->mapMemory(memory.get(), 0, bytes.size_bytes(), {});
-        memcpy(mapped, bytes.data(), bytes.size_bytes());
-        device->unmapMemory(memory.get());
-    }
-    auto createStagingBuffer(const auto& data) const {
-        auto ret = createBuffer(
-            std::span(data).size_bytes(),
-            vk::BufferUsageFlagBits::eTransferSrc,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-        );
-        fillBuffer(ret.second, data);
-        return ret;
-    }
-    auto tempCommandBuffer() const {
-        class TempCommandBuffer {
-            vk::UniqueCommandBuffer commandBuffer;
-            vk::Queue queue;
-            bool done = false;
-            TempCommandBuffer(vk::UniqueCommandBuffer commandBuffer, vk::Queue queue)
-                : commandBuffer(std::move(commandBuffer)), queue(std::move(queue)) {}
-        public:
-            TempCommandBuffer(TempCommandBuffer&& o)
-                : commandBuffer(std::move(o.commandBuffer)), queue(std::move(o.queue)) { o.done = true; }
-            operator const vk::UniqueCommandBuffer&() const { return commandBuffer; }
-            const vk::UniqueCommandBuffer& operator->() const { return commandBuffer; }
-            void end() {
-                if (done) { return; }
-                done = true;
-                commandBuffer->end();
-                queue.submit(vk::SubmitInfo {
-                    .waitSemaphoreCount = 0,
-                    .pWaitSemaphores = nullptr,
-                    .pWaitDstStageMask = nullptr,
-                    .commandBufferCount = 1,
-                    .pCommandBuffers = &commandBuffer.get(),
-                    .signalSemaphoreCount = 0,
-                    .pSignalSemaphores = nullptr,
-                }, nullptr);
-                queue.waitIdle();
-            }
-            ~TempCommandBuffer() { end(); }
-            static TempCommandBuffer make(vk::UniqueCommandBuffer commandBuffer, vk::Queue queue) {
-                return TempCommandBuffer{std::move(commandBuffer), std::move(queue)};
-            }
-        };
-        auto commandBuffer = std::move(device->allocateCommandBuffersUnique({
-            .commandPool = commandPoolUtil.get(),
-            .level = vk::CommandBufferLevel::ePrimary,
-            .commandBufferCount = 1,
-        })[0]);
-        commandBuffer->begin({
-            .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
-            .pInheritanceInfo = 0,
-        });
-        return TempCommandBuffer::make(std::move(commandBuffer), graphicsQueue);
+        assert(memory.mapping() != nullptr);
+        memcpy(memory.mapping(), bytes.data(), bytes.size_bytes());
     }
     static auto cmdCopyBuffer(
-        const vk::UniqueCommandBuffer& commandBuffer,
-        const vk::UniqueBuffer& src,
-        const vk::UniqueBuffer& dst,
-        const vk::DeviceSize& size
+        vk::CommandBuffer commandBuffer,
+        vk::Buffer src,
+        vk::DeviceSize srcOffset,
+        vk::Buffer dst,
+        vk::DeviceSize dstOffset,
+        vk::DeviceSize size
     ) {
-        commandBuffer->copyBuffer(src.get(), dst.get(), vk::BufferCopy {
-            .srcOffset = 0,
-            .dstOffset = 0,
+        commandBuffer.copyBuffer(src, dst, vk::BufferCopy {
+            .srcOffset = srcOffset,
+            .dstOffset = dstOffset,
             .size = size,
         });
     }
     static auto cmdCopyBufferToImage(
-        const vk::UniqueCommandBuffer& commandBuffer,
-        const vk::UniqueBuffer& src,
-        const vk::UniqueImage& dst,
+        vk::CommandBuffer commandBuffer,
+        vk::Buffer src,
+        vk::DeviceSize srcOffset,
+        vk::Image dst,
+        size_t y,
         size_t w,
         size_t h
     ) {
-        commandBuffer->copyBufferToImage(src.get(), dst.get(), vk::ImageLayout::eTransferDstOptimal, vk::BufferImageCopy {
-            .bufferOffset = 0,
+        commandBuffer.copyBufferToImage(src, dst, vk::ImageLayout::eTransferDstOptimal, vk::BufferImageCopy {
+            .bufferOffset = srcOffset,
             .bufferRowLength = 0,
             .bufferImageHeight = 0,
             .imageSubresource = {
@@ -324,7 +320,7 @@ struct GraphicsContext {
                 .baseArrayLayer = 0,
                 .layerCount = 1,
             },
-            .imageOffset = {0, 0, 0},
+            .imageOffset = {0, (int32_t) y, 0},
             .imageExtent = {
                 .width = (uint32_t) w,
                 .height = (uint32_t) h,
@@ -332,16 +328,140 @@ struct GraphicsContext {
             },
         });
     }
-    auto createDeviceLocalBuffer(vk::BufferUsageFlags usage, const auto& data) const {
+    auto createDeviceLocalBuffer(vk::BufferUsageFlags usage, const auto& data, MemoryCategory category = MemoryCategory::mesh) const {
         const auto bytes = std::as_bytes(std::span(data));
-        auto stagingBuffer = createStagingBuffer(bytes);
-        auto localBuffer = createBuffer(
-            bytes.size(),
-            vk::BufferUsageFlagBits::eTransferDst | usage,
-            vk::MemoryPropertyFlagBits::eDeviceLocal
-        );
-        cmdCopyBuffer(tempCommandBuffer(), stagingBuffer.first, localBuffer.first, bytes.size());
-        return localBuffer;
+        // Transfer usage also lets AssetPool::compact() move the buffer
+        const vk::BufferCreateInfo info = {
+            .flags = {},
+            .size = bytes.size(),
+            .usage = usage | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+        };
+        if (props.zeroCopyUploads) {
+            using mem = vk::MemoryPropertyFlagBits;
+            auto localBuffer = createBuffer(info, mem::eDeviceLocal | mem::eHostVisible | mem::eHostCoherent, category);
+            fillBuffer(localBuffer.second, bytes);
+            return BufferResource {
+                .buffer = std::move(localBuffer.first),
+                .memory = std::move(localBuffer.second),
+                .info = info,
+            };
+        }
+        auto localBuffer = createBuffer(info, vk::MemoryPropertyFlagBits::eDeviceLocal, category);
+        for (size_t offset = 0; offset < bytes.size(); offset += stagingRing->chunkSize()) {
+            const auto chunk = bytes.subspan(offset, std::min<size_t>(stagingRing->chunkSize(), bytes.size() - offset));
+            const auto staging = uploads->stage(chunk.size());
+            std::ranges::copy(chunk, staging.data.begin());
+            cmdCopyBuffer(uploads->commandBuffer(), staging.buffer, staging.offset, localBuffer.first.get(), offset, chunk.size());
+        }
+        uploads->releaseBuffer(localBuffer.first.get());
+        return BufferResource {
+            .buffer = std::move(localBuffer.first),
+            .memory = std::move(localBuffer.second),
+            .info = info,
+        };
+    }
+    bool supportsHostImageCopy(vk::Format format) const {
+        if (!props.hostImageCopy) { return false; }
+        const auto formatProperties = physicalDevice.getFormatProperties2<vk::FormatProperties2, vk::FormatProperties3>(format);
+        return bool(formatProperties.get<vk::FormatProperties3>().optimalTilingFeatures & vk::FormatFeatureFlagBits2::eHostImageTransferEXT);
+    }
+    // Writes all mip levels from host memory with VK_EXT_host_image_copy, no staging or queue submission.
+    // Mipmaps are generated on the CPU, so only 8 bit per channel formats are supported.
+    auto createHostCopiedImage(
+        std::span<const std::byte> bytes,
+        size_t w,
+        size_t h,
+        const vk::Format& format,
+        uint32_t mipLevels
+    ) const {
+        using usage = vk::ImageUsageFlagBits;
+        const vk::ImageCreateInfo info = {
+            .flags = {},
+            .imageType = vk::ImageType::e2D,
+            .format = format,
+            .extent = vk::Extent3D {
+                .width = (uint32_t) w,
+                .height = (uint32_t) h,
+                .depth = 1,
+            },
+            .mipLevels = mipLevels,
+            .arrayLayers = 1,
+            .samples = vk::SampleCountFlagBits::e1,
+            .tiling = vk::ImageTiling::eOptimal,
+            .usage = usage::eHostTransferEXT | usage::eTransferSrc | usage::eTransferDst | usage::eSampled, // Transfer for AssetPool::compact()
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr, // For shared sharingMode
+            .initialLayout = vk::ImageLayout::eUndefined,
+        };
+        auto localImage = createImage(info, vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryCategory::texture);
+        const vk::HostImageLayoutTransitionInfoEXT transition = {
+            .image = localImage.first.get(),
+            .oldLayout = vk::ImageLayout::eUndefined,
+            .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+            .subresourceRange = {
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .baseMipLevel = 0,
+                .levelCount = mipLevels,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+        device->transitionImageLayoutEXT(transition);
+        constexpr auto srgbFormats = std::to_array({
+            vk::Format::eR8Srgb,
+            vk::Format::eR8G8Srgb,
+            vk::Format::eR8G8B8Srgb,
+            vk::Format::eR8G8B8A8Srgb,
+            vk::Format::eB8G8R8A8Srgb,
+        });
+        const bool srgb = std::ranges::find(srgbFormats, format) != srgbFormats.end();
+        const size_t channels = bytes.size() / (w * h);
+        std::vector<uint8_t> mip;
+        std::span<const uint8_t> mipData(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+        size_t mipWidth = w;
+        size_t mipHeight = h;
+        for (uint32_t i = 0; i < mipLevels; i++) {
+            if (i != 0) {
+                mip = mipmaps::downsample(mipData, mipWidth, mipHeight, channels, srgb);
+                mipData = mip;
+                mipWidth = std::max<size_t>(mipWidth / 2, 1);
+                mipHeight = std::max<size_t>(mipHeight / 2, 1);
+            }
+            const vk::MemoryToImageCopyEXT region = {
+                .pHostPointer = mipData.data(),
+                .memoryRowLength = 0,
+                .memoryImageHeight = 0,
+                .imageSubresource = {
+                    .aspectMask = vk::ImageAspectFlagBits::eColor,
+                    .mipLevel = i,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+                .imageOffset = {0, 0, 0},
+                .imageExtent = {
+                    .width = (uint32_t) mipWidth,
+                    .height = (uint32_t) mipHeight,
+                    .depth = 1,
+                },
+            };
+            const vk::CopyMemoryToImageInfoEXT copyInfo = {
+                .flags = {},
+                .dstImage = localImage.first.get(),
+                .dstImageLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+                .regionCount = 1,
+                .pRegions = &region,
+            };
+            device->copyMemoryToImageEXT(copyInfo);
+        }
+        return ImageResource {
+            .image = std::move(localImage.first),
+            .memory = std::move(localImage.second),
+            .info = info,
+        };
     }
     auto createDeviceLocalImage(
         const auto& imageData,
@@ -350,9 +470,12 @@ struct GraphicsContext {
         const vk::Format& format,
         uint32_t mipLevels
     ) const {
-        const auto stagingBuffer = createStagingBuffer(imageData);
+        const auto bytes = std::as_bytes(std::span(imageData));
+        if (supportsHostImageCopy(format)) {
+            return createHostCopiedImage(bytes, w, h, format, mipLevels);
+        }
         using usage = vk::ImageUsageFlagBits;
-        auto localImage = createImage({
+        const vk::ImageCreateInfo info = {
             .flags = {},
             .imageType = vk::ImageType::e2D,
             .format = format,
@@ -370,10 +493,10 @@ struct GraphicsContext {
             .queueFamilyIndexCount = 0,
             .pQueueFamilyIndices = nullptr, // For shared sharingMode
             .initialLayout = vk::ImageLayout::eUndefined,
-        }, vk::MemoryPropertyFlagBits::eDeviceLocal);
-        auto commandBuffer = tempCommandBuffer();
+        };
+        auto localImage = createImage(info, vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryCategory::texture);
         // Transition all mipmaps to eTransferDstOptimal
-        commandBuffer->pipelineBarrier(
+        uploads->commandBuffer().pipelineBarrier(
             vk::PipelineStageFlagBits::eTopOfPipe,
             vk::PipelineStageFlagBits::eTransfer,
             {},
@@ -396,8 +519,35 @@ struct GraphicsContext {
                 },
             }
         );
-        cmdCopyBufferToImage(commandBuffer, stagingBuffer.first, localImage.first, w, h);
+        // Copy mip level 0 in chunks of whole rows
+        const size_t rowBytes = bytes.size() / h;
+        const size_t texelAlignment = std::lcm<size_t>(rowBytes / w, 4); // bufferOffset requirement
+        // Transfer families may only copy whole units of minImageTransferGranularity, dedicated ones often 8x8 or more.
+        // Rows are copied whole, so only the chunks' first row and height need rounding; the last chunk ends at the image edge
+        const uint32_t rowGranularity = props.queueFamilyProperties[props.transferQueueFamily].minImageTransferGranularity.height;
+        const size_t rowsPerChunk = std::max<size_t>(stagingRing->chunkSize() / rowBytes / rowGranularity, 1) * rowGranularity;
+        for (size_t y = 0; y < h; y += rowsPerChunk) {
+            const size_t rows = std::min(rowsPerChunk, h - y);
+            const auto staging = uploads->stage(rows * rowBytes, texelAlignment);
+            std::ranges::copy(bytes.subspan(y * rowBytes, rows * rowBytes), staging.data.begin());
+            cmdCopyBufferToImage(uploads->commandBuffer(), staging.buffer, staging.offset, localImage.first.get(), y, w, rows);
+        }
+        // Blits need a graphics queue
+        uploads->releaseImage(
+            localImage.first.get(),
+            {
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .baseMipLevel = 0,
+                .levelCount = mipLevels,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite
+        );
         // Generate mipmaps and transition
+        const auto commandBuffer = uploads->graphicsCommandBuffer();
         [&] {
             const auto features = physicalDevice.getFormatProperties(format).optimalTilingFeatures;
             assert(features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
@@ -407,7 +557,7 @@ struct GraphicsContext {
                 const int32_t dstMipWidth = std::max(srcMipWidth / 2, 1);
                 const int32_t dstMipHeight = std::max(srcMipHeight / 2, 1);
                 // Transition src mipmap to eTransferSrcOptimal
-                commandBuffer->pipelineBarrier(
+                commandBuffer.pipelineBarrier(
                     vk::PipelineStageFlagBits::eTransfer,
                     vk::PipelineStageFlagBits::eTransfer,
                     {},
@@ -431,7 +581,7 @@ struct GraphicsContext {
                     }
                 );
                 // Generate dst mipmap
-                commandBuffer->blitImage(
+                commandBuffer.blitImage(
                     localImage.first.get(), vk::ImageLayout::eTransferSrcOptimal,
                     localImage.first.get(), vk::ImageLayout::eTransferDstOptimal,
                     vk::ImageBlit {
@@ -459,7 +609,7 @@ struct GraphicsContext {
                     vk::Filter::eLinear
                 );
                 // Transition src mipmap to eShaderReadOnlyOptimal
-                commandBuffer->pipelineBarrier(
+                commandBuffer.pipelineBarrier(
                     vk::PipelineStageFlagBits::eTransfer,
                     vk::PipelineStageFlagBits::eFragmentShader,
                     {},
@@ -485,7 +635,7 @@ struct GraphicsContext {
                 srcMipWidth = dstMipWidth;
                 srcMipHeight = dstMipHeight;
             }
-            commandBuffer->pipelineBarrier(
+            commandBuffer.pipelineBarrier(
                 vk::PipelineStageFlagBits::eTransfer,
                 vk::PipelineStageFlagBits::eFragmentShader,
                 {},
@@ -509,8 +659,11 @@ struct GraphicsContext {
                 }
             );
         }();
-        commandBuffer.end();
-        return localImage;
+        return ImageResource {
+            .image = std::move(localImage.first),
+            .memory = std::move(localImage.second),
+            .info = info,
+        };
     }
     auto createShaderModule(const char* filename) const {
         const auto slurp = [](const char* filename) {
@@ -551,8 +704,7 @@ struct GraphicsContext {
             }
         }
         return device->createDescriptorPoolUnique({
-            // .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-            .flags = {},
+            .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
             .maxSets = (uint32_t) count,
             .poolSizeCount = (uint32_t) poolSizes.size(),
             .pPoolSizes = count == 1 ? poolSizes.data() : poolSizesVec.data(),
@@ -560,15 +712,22 @@ struct GraphicsContext {
     }
 };
 
-inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface) {
+struct GraphicsContextOptions {
+    // Write buffers straight into device-local memory when it is host visible (integrated GPUs, CPU implementations)
+    bool allowZeroCopyUploads = true;
+};
+
+// Without a surface (nullptr) the context is headless: no swapchain support, presentQueue is the graphics queue
+inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface, const GraphicsContextOptions& options = {}) {
     GraphicsContext vlk;
 
     vlk.instance = instance;
 
     // List of required device extensions
-    constexpr auto requiredDeviceExtensions = std::to_array({
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-    });
+    std::vector<const char*> requiredDeviceExtensions;
+    if (surface) {
+        requiredDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     // Pick physical device
     vlk.physicalDevice = pickPhysicalDevice(vlk.instance, surface, requiredDeviceExtensions);
@@ -585,6 +744,55 @@ inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface) {
     vlk.props.queueFamilyProperties = vlk.physicalDevice.getQueueFamilyProperties();
     prn("Anisotropic filtering:", vlk.props.maxAnisotropy ? fmt_raw(static_cast<uint32_t>(vlk.props.maxAnisotropy), "x") : "disabled");
     prn("Multisampling:", fmt_raw(static_cast<uint32_t>(vlk.props.maxSampleCount), "x"));
+    vlk.props.zeroCopyUploads = [&] {
+        // Only if the host-visible type lives on the main device-local heap, not on a small BAR window
+        using mem = vk::MemoryPropertyFlagBits;
+        const auto memoryProperties = vlk.physicalDevice.getMemoryProperties();
+        const auto heaps = std::span<const vk::MemoryHeap>(memoryProperties.memoryHeaps.data(), memoryProperties.memoryHeapCount);
+        const auto types = std::span<const vk::MemoryType>(memoryProperties.memoryTypes.data(), memoryProperties.memoryTypeCount);
+        vk::DeviceSize largestLocalHeap = 0;
+        for (const auto& heap : heaps) {
+            if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) { largestLocalHeap = std::max(largestLocalHeap, heap.size); }
+        }
+        return options.allowZeroCopyUploads && std::ranges::any_of(types, [&](const vk::MemoryType& type) {
+            const auto required = mem::eDeviceLocal | mem::eHostVisible | mem::eHostCoherent;
+            return (type.propertyFlags & required) == required && heaps[type.heapIndex].size == largestLocalHeap;
+        });
+    }();
+    prn("Zero-copy buffer uploads:", vlk.props.zeroCopyUploads);
+    vlk.props.hostImageCopy = [&] {
+        if (vlk.props.deviceProperties.apiVersion < VK_API_VERSION_1_3) { return false; }
+        const auto availableExtensions = vlk.physicalDevice.enumerateDeviceExtensionProperties();
+        const bool available = std::ranges::any_of(availableExtensions, [](const auto& e) {
+            return std::string_view(e.extensionName) == VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME;
+        });
+        if (!available) { return false; }
+        const auto features = vlk.physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceHostImageCopyFeaturesEXT>();
+        if (!features.get<vk::PhysicalDeviceHostImageCopyFeaturesEXT>().hostImageCopy) { return false; }
+        // Textures are sampled in eShaderReadOnlyOptimal, host copies must be able to write it
+        vk::PhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProperties = {};
+        vk::PhysicalDeviceProperties2 properties = { .pNext = &hostImageCopyProperties };
+        vlk.physicalDevice.getProperties2(&properties);
+        std::vector<vk::ImageLayout> copyDstLayouts(hostImageCopyProperties.copyDstLayoutCount);
+        hostImageCopyProperties.pCopyDstLayouts = copyDstLayouts.data();
+        vlk.physicalDevice.getProperties2(&properties);
+        return std::ranges::find(copyDstLayouts, vk::ImageLayout::eShaderReadOnlyOptimal) != copyDstLayouts.end();
+    }();
+    prn("Host image copy:", vlk.props.hostImageCopy);
+    vlk.props.lazilyAllocatedMemory = [&] {
+        const auto memoryProperties = vlk.physicalDevice.getMemoryProperties();
+        const auto types = std::span<const vk::MemoryType>(memoryProperties.memoryTypes.data(), memoryProperties.memoryTypeCount);
+        return std::ranges::any_of(types, [](const vk::MemoryType& type) {
+            return bool(type.propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
+        });
+    }();
+    prn("Lazily allocated memory:", vlk.props.lazilyAllocatedMemory);
+    vlk.props.bufferDeviceAddress = vlk.physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>()
+        .get<vk::PhysicalDeviceVulkan12Features>().bufferDeviceAddress;
+    prn("Buffer device address:", vlk.props.bufferDeviceAddress);
+    vlk.props.memoryBudget = std::ranges::any_of(vlk.physicalDevice.enumerateDeviceExtensionProperties(), [](const auto& e) {
+        return std::string_view(e.extensionName) == VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    });
 
 
     // Get queue family indices for chosen device
@@ -596,7 +804,7 @@ inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface) {
         assert(false);
     }();
     vlk.props.presentQueueFamily = [&] {
-        if (vlk.physicalDevice.getSurfaceSupportKHR(vlk.props.graphicsQueueFamily, surface)) {
+        if (!surface || vlk.physicalDevice.getSurfaceSupportKHR(vlk.props.graphicsQueueFamily, surface)) {
             return vlk.props.graphicsQueueFamily;
         }
         const auto len = vlk.physicalDevice.getQueueFamilyProperties().size();
@@ -607,13 +815,30 @@ inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface) {
         }
         assert(false);
     }();
+    vlk.props.transferQueueFamily = [&] {
+        // Prefer a transfer-only family, those are backed by dedicated copy engines.
+        // A zero granularity only allows copying whole mip levels, textures are uploaded in row chunks
+        const auto& families = vlk.props.queueFamilyProperties;
+        for (uint32_t i = 0; i < families.size(); i++) {
+            using q = vk::QueueFlagBits;
+            const auto& granularity = families[i].minImageTransferGranularity;
+            if (granularity.width == 0 || granularity.height == 0) { continue; }
+            if ((families[i].queueFlags & (q::eTransfer | q::eGraphics | q::eCompute)) == q::eTransfer) {
+                return i;
+            }
+        }
+        return vlk.props.graphicsQueueFamily;
+    }();
     vlk.props.uniqueQueueFamilies = {vlk.props.graphicsQueueFamily, vlk.props.presentQueueFamily};
+    prn("Dedicated transfer queue:", vlk.props.transferQueueFamily != vlk.props.graphicsQueueFamily);
 
     // Create logical device
     vlk.device = [&] {
         const float queuePriority = 1.0f;
         std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-        for (const auto& e : vlk.props.uniqueQueueFamilies) {
+        auto deviceQueueFamilies = vlk.props.uniqueQueueFamilies;
+        deviceQueueFamilies.insert(vlk.props.transferQueueFamily);
+        for (const auto& e : deviceQueueFamilies) {
             queueCreateInfos.push_back({
                 .flags = {},
                 .queueFamilyIndex = e,
@@ -624,23 +849,52 @@ inline auto makeGraphicsContext(vk::Instance instance, vk::SurfaceKHR surface) {
         const vk::PhysicalDeviceFeatures usedFeatures {
             .samplerAnisotropy = vlk.props.deviceFeatures.samplerAnisotropy,
         };
+        vk::PhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures = {
+            .hostImageCopy = VK_TRUE,
+        };
+        vk::PhysicalDeviceVulkan12Features vulkan12Features = {
+            .pNext = vlk.props.hostImageCopy ? &hostImageCopyFeatures : nullptr,
+            .timelineSemaphore = VK_TRUE,
+            .bufferDeviceAddress = vlk.props.bufferDeviceAddress,
+        };
+        std::vector<const char*> enabledExtensions(requiredDeviceExtensions.begin(), requiredDeviceExtensions.end());
+        if (vlk.props.hostImageCopy) {
+            enabledExtensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+        }
+        if (vlk.props.memoryBudget) {
+            enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
         return vlk.physicalDevice.createDeviceUnique({
+            .pNext = &vulkan12Features,
             .flags = {},
             .queueCreateInfoCount = (uint32_t) queueCreateInfos.size(),
             .pQueueCreateInfos = queueCreateInfos.data(),
-            .enabledExtensionCount = (uint32_t) requiredDeviceExtensions.size(), // Device extensions, not instance extensions
-            .ppEnabledExtensionNames = requiredDeviceExtensions.data(),
+            .enabledExtensionCount = (uint32_t) enabledExtensions.size(), // Device extensions, not instance extensions
+            .ppEnabledExtensionNames = enabledExtensions.data(),
             .pEnabledFeatures = &usedFeatures,
         });
     }();
+    // Device functions straight from vkGetDeviceProcAddr, including extension ones. Assumes a single device.
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(vlk.device.get());
+    vlk.allocator = std::make_unique<DeviceAllocator>(vlk.physicalDevice, vlk.device.get(), vlk.props.memoryBudget);
+    vlk.stagingRing = std::make_unique<StagingRing>(vlk.device.get(), *vlk.allocator, 32 << 20);
 
     vlk.graphicsQueue = vlk.device->getQueue(vlk.props.graphicsQueueFamily, 0);
     vlk.presentQueue = vlk.device->getQueue(vlk.props.presentQueueFamily, 0);
+    vlk.transferQueue = vlk.device->getQueue(vlk.props.transferQueueFamily, 0);
 
-    vlk.commandPoolUtil = vlk.device->createCommandPoolUnique({
-        .flags = vk::CommandPoolCreateFlagBits::eTransient,
-        .queueFamilyIndex = vlk.props.graphicsQueueFamily,
-    });
+    vlk.graphicsTimeline = std::make_unique<QueueTimeline>(vlk.device.get(), vlk.graphicsQueue);
+    if (vlk.props.transferQueueFamily != vlk.props.graphicsQueueFamily) {
+        vlk.transferTimeline = std::make_unique<QueueTimeline>(vlk.device.get(), vlk.transferQueue);
+    }
+
+    vlk.uploads = std::make_unique<UploadContext>(
+        vlk.device.get(),
+        vlk.transferTimeline ? vlk.transferTimeline.get() : vlk.graphicsTimeline.get(), vlk.props.transferQueueFamily,
+        vlk.graphicsTimeline.get(), vlk.props.graphicsQueueFamily,
+        vlk.stagingRing.get()
+    );
+    vlk.deletionQueue = std::make_unique<DeletionQueue>(vlk.graphicsTimeline.get());
 
     return vlk;
 }
@@ -3,7 +3,7 @@
 
 struct ImageAttachment {
     vk::UniqueImage image;
-    vk::UniqueDeviceMemory deviceMemory;
+    DeviceAllocation deviceMemory;
     vk::UniqueImageView imageView;
 };
 
@@ -13,7 +13,7 @@ inline auto makeImageAttachment(
     vk::MemoryPropertyFlags memoryProperties,
     vk::ImageAspectFlags aspectMask
 ) {
-    auto [image, deviceMemory] = vlk->createImage(createInfo, memoryProperties);
+    auto [image, deviceMemory] = vlk->createImage(createInfo, memoryProperties, MemoryCategory::attachment);
     auto imageView = vlk->device->createImageViewUnique({
         .flags = {},
         .image = image.get(),
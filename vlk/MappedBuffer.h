@@ -2,13 +2,15 @@
 #include "GraphicsContext.h"
 
 struct MappedBuffer {
-    std::pair<vk::UniqueBuffer, vk::UniqueDeviceMemory> buffer;
+    std::pair<vk::UniqueBuffer, DeviceAllocation> buffer;
     void* mapping;
 };
 
-inline auto makeMappedBuffer(const GraphicsContext* vlk, uint32_t size, vk::BufferUsageFlags usage) {
+inline auto makeMappedBuffer(const GraphicsContext* vlk, uint32_t size, vk::BufferUsageFlags usage, MemoryCategory category = MemoryCategory::uniform) {
     MappedBuffer ret;
-    ret.buffer = vlk->createBuffer(size, usage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    ret.mapping = vlk->device->mapMemory(ret.buffer.second.get(), 0, size, {});
+    using mem = vk::MemoryPropertyFlagBits;
+    const auto properties = mem::eHostVisible | mem::eHostCoherent | (vlk->props.zeroCopyUploads ? mem::eDeviceLocal : vk::MemoryPropertyFlags{});
+    ret.buffer = vlk->createBuffer(size, usage, properties, category);
+    ret.mapping = ret.buffer.second.mapping();
     return ret;
 }
@@ -0,0 +1,140 @@
+#pragma once
+#include "FramePacer.h"
+#include "GraphicsContext.h"
+#include "ImageAttachment.h"
+#include "utils.h"
+
+// Renders into a ring of plain images instead of a swapchain, needs no window or surface.
+// Same startFrame()/endFrame()/renderTarget() contract as WindowRenderTarget;
+// frames are never throttled by presentation, only by framesInFlight.
+// With viewCount > 1 each frame renders that many images (batch rendering of independent views).
+class OffscreenRenderTarget {
+private:
+    const GraphicsContext* vlk;
+    vk::Extent2D extent;
+    vk::Format format;
+    uint32_t viewCount;
+
+    // viewCount per frame in flight, so a frame's images are free once its slot is
+    std::vector<ImageAttachment> images;
+    std::vector<vk::Image> imageHandles;
+    std::vector<vk::ImageView> imageViews;
+    static constexpr vk::ImageUsageFlags usage =
+        vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+
+    vk::UniqueCommandPool frameCommandPool;
+    struct FrameInFlight {
+        vk::UniqueCommandBuffer commandBuffer;
+        uint64_t timelineValue = 0; // Graphics timeline value signaled by the last frame submitted in this slot
+    };
+    std::vector<FrameInFlight> framesInFlight;
+    uint64_t frameNumber = 0; // Frames are numbered from 1
+
+    std::optional<Frame> activeFrame = std::nullopt;
+
+private:
+    void createImages(uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            images.push_back(makeImageAttachment(vlk, {
+                .flags = {},
+                .imageType = vk::ImageType::e2D,
+                .format = format,
+                .extent = {
+                    .width = extent.width,
+                    .height = extent.height,
+                    .depth = 1,
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = vk::SampleCountFlagBits::e1,
+                .tiling = vk::ImageTiling::eOptimal,
+                .usage = usage,
+                .sharingMode = vk::SharingMode::eExclusive,
+                .queueFamilyIndexCount = 0,
+                .pQueueFamilyIndices = nullptr,
+                .initialLayout = vk::ImageLayout::eUndefined,
+            }, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eColor));
+            imageHandles.push_back(images.back().image.get());
+            imageViews.push_back(images.back().imageView.get());
+        }
+    }
+
+    void createFramesInFlight(uint32_t count) {
+        frameCommandPool = vlk->device->createCommandPoolUnique({
+            .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            .queueFamilyIndex = vlk->props.graphicsQueueFamily,
+        });
+
+        framesInFlight.resize(count);
+        for (auto& f : framesInFlight) {
+            f = {
+                .commandBuffer = std::move(vlk->device->allocateCommandBuffersUnique({
+                    .commandPool = frameCommandPool.get(),
+                    .level = vk::CommandBufferLevel::ePrimary,
+                    .commandBufferCount = 1,
+                })[0]),
+            };
+        }
+    }
+
+public:
+    explicit OffscreenRenderTarget(
+        const GraphicsContext* vlk,
+        vk::Extent2D extent,
+        vk::Format format = vk::Format::eB8G8R8A8Srgb,
+        uint32_t framesInFlight = 2,
+        uint32_t viewCount = 1
+    ) : vlk(vlk), extent(extent), format(format), viewCount(viewCount), pacer(vlk, framesInFlight)
+    {
+        assert(framesInFlight >= 1 && viewCount >= 1);
+        createImages(framesInFlight * viewCount);
+        createFramesInFlight(framesInFlight);
+    }
+
+    // Measures frame times, see FramePacer
+    FramePacer pacer;
+
+    RenderTarget renderTarget() const {
+        return {
+            .extent = extent,
+            .format = format,
+            .images = imageHandles,
+            .imageViews = imageViews,
+            .usage = usage,
+            .finalLayout = vk::ImageLayout::eTransferSrcOptimal,
+        };
+    }
+
+    uint32_t framesInFlightCount() const { return framesInFlight.size(); }
+
+    [[nodiscard]]
+    std::optional<Frame> startFrame() {
+        const uint32_t frameIndex = frameNumber % framesInFlight.size();
+        const auto& frameResources = framesInFlight[frameIndex];
+        pacer.beginWait();
+        vlk->graphicsTimeline->wait(frameResources.timelineValue);
+        frameNumber++;
+        vlk->deletionQueue->collect();
+        pacer.frameStarted(frameIndex);
+        return activeFrame = Frame {
+            .commandBuffer = frameResources.commandBuffer.get(),
+            .frameIndex = frameIndex,
+            .imageIndex = frameIndex * viewCount,
+            .viewCount = viewCount,
+        };
+    }
+
+    // Returns the graphics timeline value of the frame's submission
+    uint64_t endFrame() {
+        assert(activeFrame.has_value());
+        auto& frameResources = framesInFlight[activeFrame->frameIndex];
+        // Uploads recorded during this frame must run before it
+        vlk->uploads->flush();
+        const auto commandBuffers = pacer.submittedCommandBuffers(activeFrame->frameIndex, frameResources.commandBuffer.get());
+        frameResources.timelineValue = vlk->graphicsTimeline->submit(commandBuffers);
+        vlk->deletionQueue->submitted(frameResources.timelineValue);
+        pacer.frameSubmitted(activeFrame->frameIndex, frameResources.timelineValue);
+        activeFrame = std::nullopt;
+        return frameResources.timelineValue;
+    }
+};
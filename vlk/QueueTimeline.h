@@ -0,0 +1,120 @@
+#pragma once
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <span>
+
+// Timeline semaphore signaled by every submission to one queue.
+// Each submit signals the next value, so all GPU progress on the queue is a single 64-bit number:
+// work submitted with value v is done once the semaphore reaches v.
+class QueueTimeline {
+public:
+    struct Wait {
+        vk::Semaphore semaphore;
+        uint64_t value; // Ignored for binary semaphores
+        vk::PipelineStageFlags stage;
+    };
+
+private:
+    vk::Device device;
+    vk::Queue queue_;
+    vk::UniqueSemaphore semaphore;
+    uint64_t lastSubmitted_ = 0;
+    std::atomic<uint64_t> completed_ = 0; // Last value seen, saves a call when polling finished work
+    std::mutex mutex;
+
+public:
+    QueueTimeline(vk::Device device, vk::Queue queue) : device(device), queue_(queue) {
+        vk::SemaphoreTypeCreateInfo typeInfo = {
+            .semaphoreType = vk::SemaphoreType::eTimeline,
+            .initialValue = 0,
+        };
+        semaphore = device.createSemaphoreUnique({
+            .pNext = &typeInfo,
+            .flags = {},
+        });
+    }
+    QueueTimeline(const QueueTimeline&) = delete;
+    QueueTimeline& operator=(const QueueTimeline&) = delete;
+
+    vk::Semaphore handle() const { return semaphore.get(); }
+    vk::Queue queue() const { return queue_; }
+
+    // Submits `commandBuffers` and returns the value signaled once they complete.
+    // `signals` are binary semaphores signaled as well, e.g. for presentation.
+    uint64_t submit(
+        std::span<const vk::CommandBuffer> commandBuffers,
+        std::span<const Wait> waits = {},
+        std::span<const vk::Semaphore> signals = {}
+    ) {
+        std::vector<vk::Semaphore> waitSemaphores;
+        std::vector<uint64_t> waitValues;
+        std::vector<vk::PipelineStageFlags> waitStages;
+        for (const auto& e : waits) {
+            waitSemaphores.push_back(e.semaphore);
+            waitValues.push_back(e.value);
+            waitStages.push_back(e.stage);
+        }
+        std::vector<vk::Semaphore> signalSemaphores(signals.begin(), signals.end());
+        signalSemaphores.push_back(semaphore.get());
+        std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+
+        std::scoped_lock lock(mutex);
+        const uint64_t value = lastSubmitted_ + 1;
+        signalValues.back() = value;
+        const vk::TimelineSemaphoreSubmitInfo timelineInfo = {
+            .waitSemaphoreValueCount = (uint32_t) waitValues.size(),
+            .pWaitSemaphoreValues = waitValues.data(),
+            .signalSemaphoreValueCount = (uint32_t) signalValues.size(),
+            .pSignalSemaphoreValues = signalValues.data(),
+        };
+        queue_.submit(vk::SubmitInfo {
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = (uint32_t) waitSemaphores.size(),
+            .pWaitSemaphores = waitSemaphores.data(),
+            .pWaitDstStageMask = waitStages.data(),
+            .commandBufferCount = (uint32_t) commandBuffers.size(),
+            .pCommandBuffers = commandBuffers.data(),
+            .signalSemaphoreCount = (uint32_t) signalSemaphores.size(),
+            .pSignalSemaphores = signalSemaphores.data(),
+        }, nullptr);
+        lastSubmitted_ = value;
+        return value;
+    }
+
+    uint64_t lastSubmitted() {
+        std::scoped_lock lock(mutex);
+        return lastSubmitted_;
+    }
+
+    uint64_t completedValue() {
+        const uint64_t value = device.getSemaphoreCounterValue(semaphore.get());
+        uint64_t seen = completed_;
+        while (seen < value && !completed_.compare_exchange_weak(seen, value)) {}
+        return std::max(seen, value);
+    }
+
+    bool isComplete(uint64_t value) {
+        return value <= completed_ || value <= completedValue();
+    }
+
+    void wait(uint64_t value) {
+        if (value <= completed_) { return; }
+        (void) device.waitSemaphores({
+            .flags = {},
+            .semaphoreCount = 1,
+            .pSemaphores = &semaphore.get(),
+            .pValues = &value,
+        }, -1);
+        uint64_t seen = completed_;
+        while (seen < value && !completed_.compare_exchange_weak(seen, value)) {}
+    }
+
+    // Waits for everything submitted so far
+    void waitIdle() {
+        wait(lastSubmitted());
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+#include <deque>
+#include <optional>
+#include <span>
+#include "DeviceAllocator.h"
+
+// Persistently mapped host-visible buffer used as a ring for upload data.
+// Allocations made since the last retire() belong to the ticket passed to it
+// and are reclaimed once reclaim() is called with a completed ticket at least that high.
+class StagingRing {
+public:
+    struct Allocation {
+        vk::Buffer buffer;
+        vk::DeviceSize offset;
+        std::span<std::byte> data;
+    };
+
+private:
+    vk::UniqueBuffer buffer;
+    DeviceAllocation memory;
+    std::byte* mapping;
+    vk::DeviceSize capacity_;
+    vk::DeviceSize head = 0;
+    vk::DeviceSize used = 0;      // Including alignment and wrap-around padding
+    vk::DeviceSize openBytes = 0; // Allocated since last retire()
+
+    struct Region {
+        vk::DeviceSize bytes;
+        uint64_t ticket;
+    };
+    std::deque<Region> inFlight;
+
+    static vk::DeviceSize alignUp(vk::DeviceSize v, vk::DeviceSize alignment) {
+        return (v + alignment - 1) / alignment * alignment;
+    }
+
+public:
+    StagingRing(vk::Device device, DeviceAllocator& allocator, vk::DeviceSize capacity)
+        : capacity_(capacity)
+    {
+        buffer = device.createBufferUnique({
+            .flags = {},
+            .size = capacity,
+            .usage = vk::BufferUsageFlagBits::eTransferSrc,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+        });
+        memory = allocator.allocate(
+            device.getBufferMemoryRequirements(buffer.get()),
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            true,
+            MemoryCategory::staging
+        );
+        device.bindBufferMemory(buffer.get(), memory.memory(), memory.offset());
+        mapping = static_cast<std::byte*>(memory.mapping());
+    }
+
+    vk::DeviceSize capacity() const { return capacity_; }
+    // Uploads larger than this should be split, so that one upload never has to wait for the whole ring
+    vk::DeviceSize chunkSize() const { return capacity_ / 4; }
+    bool hasOpenAllocations() const { return openBytes != 0; }
+    // Ticket to wait for before more space can be reclaimed
+    std::optional<uint64_t> oldestTicket() const {
+        if (inFlight.empty()) { return std::nullopt; }
+        return inFlight.front().ticket;
+    }
+
+    std::optional<Allocation> tryAlloc(vk::DeviceSize size, vk::DeviceSize alignment = 16) {
+        assert(size <= capacity_);
+        if (used == 0) { head = 0; }
+        vk::DeviceSize offset = alignUp(head, alignment);
+        if (offset + size > capacity_) { offset = 0; }
+        const vk::DeviceSize consumed = offset >= head ? offset + size - head : capacity_ - head + size;
+        if (used + consumed > capacity_) { return std::nullopt; }
+        head = offset + size;
+        used += consumed;
+        openBytes += consumed;
+        return Allocation {
+            .buffer = buffer.get(),
+            .offset = offset,
+            .data = std::span(mapping + offset, size),
+        };
+    }
+
+    // Closes the current region, it is freed once `ticket` completes
+    void retire(uint64_t ticket) {
+        if (openBytes == 0) { return; }
+        inFlight.push_back({
+            .bytes = std::exchange(openBytes, 0),
+            .ticket = ticket,
+        });
+    }
+
+    void reclaim(uint64_t completedTicket) {
+        while (!inFlight.empty() && inFlight.front().ticket <= completedTicket) {
+            used -= inFlight.front().bytes;
+            inFlight.pop_front();
+        }
+    }
+};
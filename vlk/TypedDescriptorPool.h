@@ -6,14 +6,37 @@ struct TypedDescriptorPool {
     const GraphicsContext* vlk;
     vk::UniqueDescriptorSetLayout descriptorSetLayout;
     std::vector<vk::DescriptorPoolSize> poolSizes;
-    std::vector<vk::UniqueDescriptorPool> descriptorPools;
-public:
-    vk::DescriptorSet alloc() const {
-        return std::move(vlk->device->allocateDescriptorSets({
+    mutable std::vector<vk::UniqueDescriptorPool> descriptorPools; // A new one is added when the last is full
+    mutable std::map<vk::DescriptorSet, vk::DescriptorPool> owners;
+private:
+    vk::DescriptorSet allocFromLast() const {
+        auto ret = std::move(vlk->device->allocateDescriptorSets({
             .descriptorPool = descriptorPools.back().get(),
             .descriptorSetCount = 1,
             .pSetLayouts = &descriptorSetLayout.get(),
         })[0]);
+        owners.emplace(ret, descriptorPools.back().get());
+        return ret;
+    }
+public:
+    vk::DescriptorSet alloc() const {
+        try {
+            return allocFromLast();
+        } catch (const vk::OutOfPoolMemoryError&) {
+        } catch (const vk::FragmentedPoolError&) {
+        }
+        descriptorPools.push_back(vlk->createDescriptorPool(poolSizes, 16));
+        return allocFromLast();
+    }
+    // The set is returned to its pool once frames that may have bound it have finished.
+    // The pool has to outlive that, see DeletionQueue::clear().
+    void free(vk::DescriptorSet descriptorSet) const {
+        const auto it = owners.find(descriptorSet);
+        assert(it != owners.end());
+        vlk->deletionQueue->defer([device = vlk->device.get(), pool = it->second, descriptorSet] {
+            device.freeDescriptorSets(pool, descriptorSet);
+        });
+        owners.erase(it);
     }
 };
 
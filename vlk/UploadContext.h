@@ -0,0 +1,270 @@
+#pragma once
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+#include <deque>
+#include <optional>
+#include "QueueTimeline.h"
+#include "StagingRing.h"
+
+// Identifies one upload submission. Tickets increase monotonically,
+// so completion of a ticket implies completion of all lower ones.
+using UploadTicket = uint64_t;
+
+// Records copy and mip generation commands from many uploads into one
+// command buffer and submits them together on flush().
+// With a dedicated transfer queue family copies run there, and resources
+// are handed over to the graphics family with release/acquire barriers.
+// Completion is tracked on the graphics queue's timeline.
+class UploadContext {
+    vk::Device device;
+    QueueTimeline* transferTimeline; // Same as graphicsTimeline without a dedicated transfer family
+    QueueTimeline* graphicsTimeline;
+    uint32_t transferQueueFamily;
+    uint32_t graphicsQueueFamily;
+    StagingRing* stagingRing;
+    vk::UniqueCommandPool commandPool;
+    vk::UniqueCommandPool graphicsCommandPool;
+
+    struct Batch {
+        vk::UniqueCommandBuffer commandBuffer;         // Transfer family
+        vk::UniqueCommandBuffer graphicsCommandBuffer; // Only with a dedicated transfer family
+        UploadTicket ticket;
+        uint64_t timelineValue; // On graphicsTimeline, once submitted
+    };
+    std::optional<Batch> recording;
+    std::deque<Batch> submitted;
+    std::vector<Batch> freeBatches;
+    UploadTicket nextTicket = 1;
+    UploadTicket completedTicket = 0;
+
+    static vk::UniqueCommandBuffer allocateCommandBuffer(vk::Device device, vk::CommandPool commandPool) {
+        return std::move(device.allocateCommandBuffersUnique({
+            .commandPool = commandPool,
+            .level = vk::CommandBufferLevel::ePrimary,
+            .commandBufferCount = 1,
+        })[0]);
+    }
+
+    Batch takeFreeBatch() {
+        if (freeBatches.empty()) {
+            return Batch {
+                .commandBuffer = allocateCommandBuffer(device, commandPool.get()),
+                .graphicsCommandBuffer = dedicatedTransfer() ? allocateCommandBuffer(device, graphicsCommandPool.get()) : vk::UniqueCommandBuffer{},
+                .ticket = 0,
+                .timelineValue = 0,
+            };
+        }
+        auto ret = std::move(freeBatches.back());
+        freeBatches.pop_back();
+        return ret;
+    }
+
+    void poll() {
+        while (!submitted.empty() && graphicsTimeline->isComplete(submitted.front().timelineValue)) {
+            completedTicket = submitted.front().ticket;
+            freeBatches.push_back(std::move(submitted.front()));
+            submitted.pop_front();
+        }
+        stagingRing->reclaim(completedTicket);
+    }
+
+public:
+    UploadContext(
+        vk::Device device,
+        QueueTimeline* transferTimeline,
+        uint32_t transferQueueFamily,
+        QueueTimeline* graphicsTimeline,
+        uint32_t graphicsQueueFamily,
+        StagingRing* stagingRing
+    ) : device(device),
+        transferTimeline(transferTimeline),
+        graphicsTimeline(graphicsTimeline),
+        transferQueueFamily(transferQueueFamily),
+        graphicsQueueFamily(graphicsQueueFamily),
+        stagingRing(stagingRing)
+    {
+        commandPool = device.createCommandPoolUnique({
+            .flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            .queueFamilyIndex = transferQueueFamily,
+        });
+        if (dedicatedTransfer()) {
+            graphicsCommandPool = device.createCommandPoolUnique({
+                .flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                .queueFamilyIndex = graphicsQueueFamily,
+            });
+        }
+    }
+    UploadContext(const UploadContext&) = delete;
+    UploadContext& operator=(const UploadContext&) = delete;
+    ~UploadContext() {
+        flush();
+        if (!submitted.empty()) {
+            graphicsTimeline->wait(submitted.back().timelineValue);
+        }
+    }
+
+    bool dedicatedTransfer() const { return transferQueueFamily != graphicsQueueFamily; }
+
+    // Transfer command buffer of the batch being recorded.
+    // Don't hold on to it across stage() calls, those may flush.
+    vk::CommandBuffer commandBuffer() {
+        if (!recording) {
+            recording = takeFreeBatch();
+            recording->ticket = nextTicket++;
+            constexpr vk::CommandBufferBeginInfo beginInfo = {
+                .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+                .pInheritanceInfo = nullptr,
+            };
+            recording->commandBuffer->begin(beginInfo);
+            if (dedicatedTransfer()) {
+                recording->graphicsCommandBuffer->begin(beginInfo);
+            }
+        }
+        return recording->commandBuffer.get();
+    }
+
+    // Graphics family command buffer of the batch being recorded, executed after commandBuffer().
+    // Same as commandBuffer() without a dedicated transfer family.
+    vk::CommandBuffer graphicsCommandBuffer() {
+        (void) commandBuffer();
+        return dedicatedTransfer() ? recording->graphicsCommandBuffer.get() : recording->commandBuffer.get();
+    }
+
+    // Hands a buffer written by commandBuffer() over to the graphics family
+    void releaseBuffer(vk::Buffer buffer) {
+        if (!dedicatedTransfer()) { return; } // Covered by the barrier in flush()
+        vk::BufferMemoryBarrier barrier = {
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eNone,
+            .srcQueueFamilyIndex = transferQueueFamily,
+            .dstQueueFamilyIndex = graphicsQueueFamily,
+            .buffer = buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        commandBuffer().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr, barrier, nullptr);
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead;
+        graphicsCommandBuffer().pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+            {}, nullptr, barrier, nullptr
+        );
+    }
+
+    // Hands an image written by commandBuffer() over to the graphics family, keeping its layout.
+    // The graphics side makes the writes visible to dstStage/dstAccess.
+    void releaseImage(
+        vk::Image image,
+        const vk::ImageSubresourceRange& range,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags dstStage,
+        vk::AccessFlags dstAccess
+    ) {
+        if (!dedicatedTransfer()) {
+            commandBuffer().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStage, {}, nullptr, nullptr, vk::ImageMemoryBarrier {
+                .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+                .dstAccessMask = dstAccess,
+                .oldLayout = layout,
+                .newLayout = layout,
+                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+                .image = image,
+                .subresourceRange = range,
+            });
+            return;
+        }
+        vk::ImageMemoryBarrier barrier = {
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eNone,
+            .oldLayout = layout,
+            .newLayout = layout,
+            .srcQueueFamilyIndex = transferQueueFamily,
+            .dstQueueFamilyIndex = graphicsQueueFamily,
+            .image = image,
+            .subresourceRange = range,
+        };
+        commandBuffer().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr, nullptr, barrier);
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = dstAccess;
+        graphicsCommandBuffer().pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, dstStage, {}, nullptr, nullptr, barrier);
+    }
+
+    // Ticket the commands recorded right now will complete with
+    UploadTicket currentTicket() {
+        (void) commandBuffer();
+        return recording->ticket;
+    }
+
+    // Space in the staging ring, valid until the current batch completes
+    StagingRing::Allocation stage(vk::DeviceSize size, vk::DeviceSize alignment = 16) {
+        while (true) {
+            poll();
+            if (auto ret = stagingRing->tryAlloc(size, alignment)) {
+                (void) commandBuffer(); // Open allocations always belong to the recording batch
+                return *ret;
+            }
+            if (const auto oldest = stagingRing->oldestTicket()) {
+                wait(*oldest);
+            } else if (stagingRing->hasOpenAllocations()) {
+                flush();
+            } else {
+                throw ex::runtime("staging allocation larger than the staging ring");
+            }
+        }
+    }
+
+    // Submits everything recorded so far, returns the ticket of the last submission
+    UploadTicket flush() {
+        if (!recording) { return nextTicket - 1; }
+        if (!dedicatedTransfer()) {
+            // Make copied buffer data visible to every later use on this queue
+            recording->commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+                {},
+                vk::MemoryBarrier {
+                    .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+                    .dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                     vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead,
+                },
+                nullptr,
+                nullptr
+            );
+        }
+        recording->commandBuffer->end();
+        if (dedicatedTransfer()) {
+            recording->graphicsCommandBuffer->end();
+            const uint64_t transferValue = transferTimeline->submit(std::span(&recording->commandBuffer.get(), 1));
+            const auto waits = std::to_array<QueueTimeline::Wait>({{
+                .semaphore = transferTimeline->handle(),
+                .value = transferValue,
+                .stage = vk::PipelineStageFlagBits::eAllCommands,
+            }});
+            recording->timelineValue = graphicsTimeline->submit(std::span(&recording->graphicsCommandBuffer.get(), 1), waits);
+        } else {
+            recording->timelineValue = graphicsTimeline->submit(std::span(&recording->commandBuffer.get(), 1));
+        }
+        const auto ret = recording->ticket;
+        stagingRing->retire(ret);
+        submitted.push_back(std::move(*recording));
+        recording.reset();
+        return ret;
+    }
+
+    bool isComplete(UploadTicket ticket) {
+        poll();
+        return completedTicket >= ticket;
+    }
+
+    void wait(UploadTicket ticket) {
+        if (recording && recording->ticket <= ticket) { flush(); }
+        if (completedTicket >= ticket) { return; }
+        const auto it = std::ranges::find_if(submitted, [ticket](const Batch& e) { return e.ticket >= ticket; });
+        assert(it != submitted.end());
+        graphicsTimeline->wait(it->timelineValue);
+        poll();
+    }
+};
@@ -1,6 +1,8 @@
 #pragma once
+#include <atomic>
 #include <functional>
 #include <memory>
+#include "FramePacer.h"
 #include "GraphicsContext.h"
 #include "utils.h"
 
@@ -30,12 +32,16 @@ class WindowRenderTarget {
 private:
     const GraphicsContext* vlk;
     const WindowSurface* windowSurface;
+    vk::PresentModeKHR preferredPresentMode;
 
     struct SwapchainResources {
         vk::SwapchainCreateInfoKHR         info;
         vk::UniqueSwapchainKHR             swapchain;
+        std::vector<vk::Image>             images;
         std::vector<vk::UniqueImageView>   imageViewResources;
         std::vector<vk::ImageView>         imageViews;
+        // Per image, presentation may still wait on it after its frame's slot was reused
+        std::vector<vk::UniqueSemaphore>   renderFinishedSemaphores;
     } swapchain;
 
 private:
@@ -43,15 +49,17 @@ private:
     struct FrameInFlight {
         vk::UniqueCommandBuffer commandBuffer;
         vk::UniqueSemaphore imageAvailableSemaphore;
-        vk::UniqueSemaphore renderFinishedSemaphore;
-        vk::UniqueFence inFlightFence;
+        uint64_t timelineValue = 0; // Graphics timeline value signaled by the last frame submitted in this slot
     };
-    static constexpr uint32_t maxFramesInFlight = 1;
-    std::array<FrameInFlight, maxFramesInFlight> framesInFlight;
+    std::vector<FrameInFlight> framesInFlight;
+    uint64_t frameNumber = 0; // Frames are numbered from 1
+    // Sampled on the main thread, swapchains may be recreated on a render thread and GLFW is main thread only
+    std::atomic<vk::Extent2D> framebufferSize;
 
 private:
     void createSwapchain() {
-        swapchain.info = [&] {
+        const std::vector<uint32_t> uniqueQueueFamiliesVec(vlk->props.uniqueQueueFamilies.begin(), vlk->props.uniqueQueueFamilies.end());
+        auto info = [&] {
             const auto caps = vlk->physicalDevice.getSurfaceCapabilitiesKHR(windowSurface->surface.get());
             const auto formats = vlk->physicalDevice.getSurfaceFormatsKHR(windowSurface->surface.get());
             const auto presentModes = vlk->physicalDevice.getSurfacePresentModesKHR(windowSurface->surface.get());
@@ -65,24 +73,16 @@ private:
                 prn_raw("Preferred swap chain format not available, using format ", ret.format, ", color space ", ret.colorSpace);
                 return ret;
             }();
-            vk::PresentModeKHR bestPresentMode = [&availableModes = presentModes] {
-                // const auto preferredModes = std::to_array<vk::PresentModeKHR>({
-                //     vk::PresentModeKHR::eMailbox,     // Triple-buffered VSync
-                //     vk::PresentModeKHR::eFifoRelaxed, // VSync unless FPS < Refresh Rate
-                //     vk::PresentModeKHR::eFifo,        // Always force Vsync
-                //     vk::PresentModeKHR::eImmediate,   // No VSync
-                // });
-                const auto preferredModes = std::to_array<vk::PresentModeKHR>({vk::PresentModeKHR::eFifo});
-                const auto modeNames = std::to_array({
-                    "VK_PRESENT_MODE_IMMEDIATE_KHR",
-                    "VK_PRESENT_MODE_MAILBOX_KHR",
-                    "VK_PRESENT_MODE_FIFO_KHR",
-                    "VK_PRESENT_MODE_FIFO_RELAXED_KHR",
-                });
+            vk::PresentModeKHR bestPresentMode = [&availableModes = presentModes, preferred = preferredPresentMode] {
+                // eFifo is always supported
+                const auto preferredModes = std::to_array<vk::PresentModeKHR>({preferred, vk::PresentModeKHR::eFifo});
                 const auto isAvailable = [&](auto mode) { return std::ranges::find(availableModes, mode) != std::end(availableModes); };
                 const auto ret = std::ranges::find_if(preferredModes, isAvailable);
                 assert(ret != std::end(preferredModes));
-                prn("Using present mode", modeNames[static_cast<size_t>(*ret)]);
+                if (*ret != preferred) {
+                    prn("Present mode", vk::to_string(preferred), "not available");
+                }
+                prn("Using present mode", vk::to_string(*ret));
                 return *ret;
             }();
             vk::Extent2D bestSwapExtent = [&] {
@@ -90,9 +90,7 @@ private:
                     prn_raw("Using currentExtent: { ", caps.currentExtent.width, " ", caps.currentExtent.height, " }");
                     return caps.currentExtent;
                 }
-                int w, h;
-                glfwGetFramebufferSize(windowSurface->window.get(), &w, &h);
-                vk::Extent2D actualExtent = { (uint32_t) w, (uint32_t) h };
+                const vk::Extent2D actualExtent = framebufferSize.load(std::memory_order_relaxed);
                 vk::Extent2D clampedExtent = {
                     std::clamp(actualExtent.width, caps.minImageExtent.width, caps.maxImageExtent.width),
                     std::clamp(actualExtent.height, caps.minImageExtent.height, caps.maxImageExtent.height)
@@ -113,9 +111,6 @@ private:
             }
             prn_raw("Swap chain image count: ", bestImageCount, " (min ", caps.minImageCount, ", max ", caps.maxImageCount, ")");
 
-            std::vector<uint32_t> uniqueQueueFamiliesVec;
-            for (const auto& e : vlk->props.uniqueQueueFamilies) { uniqueQueueFamiliesVec.push_back(e); }
-
             return vk::SwapchainCreateInfoKHR {
                 .flags = {},
                 .surface = windowSurface->surface.get(),
@@ -124,7 +119,9 @@ private:
                 .imageColorSpace = bestFormat.colorSpace,
                 .imageExtent = bestSwapExtent,
                 .imageArrayLayers = 1,
-                .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
+                // Transfers let renderers blit into the images and read them back, where supported
+                .imageUsage = vk::ImageUsageFlagBits::eColorAttachment |
+                              (caps.supportedUsageFlags & (vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc)),
                 .imageSharingMode = vlk->props.uniqueQueueFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
                 .queueFamilyIndexCount = (uint32_t) uniqueQueueFamiliesVec.size(),
                 .pQueueFamilyIndices = uniqueQueueFamiliesVec.data(),
@@ -135,10 +132,16 @@ private:
                 .oldSwapchain = swapchain.swapchain.get(),
             };
         }();
-        swapchain.swapchain = vlk->device->createSwapchainKHRUnique(swapchain.info);
+        auto newSwapchain = vlk->device->createSwapchainKHRUnique(info);
+        // Frames in flight may still render into or present the old swapchain's images.
+        // Images not acquired from it stay valid until it is destroyed.
+        vlk->deletionQueue->push(std::exchange(swapchain, {}));
+        swapchain.info = info;
+        swapchain.swapchain = std::move(newSwapchain);
+        swapchain.images = vlk->device->getSwapchainImagesKHR(swapchain.swapchain.get());
         swapchain.imageViewResources = [&] {
             std::vector<vk::UniqueImageView> ret;
-            for (const auto& image : vlk->device->getSwapchainImagesKHR(swapchain.swapchain.get())) {
+            for (const auto& image : swapchain.images) {
                 ret.push_back(vlk->device->createImageViewUnique({
                     .flags = {},
                     .image = image,
@@ -163,14 +166,19 @@ private:
             }
             return ret;
         }();
+        swapchain.renderFinishedSemaphores.clear();
+        for (size_t i = 0; i < swapchain.imageViews.size(); i++) {
+            swapchain.renderFinishedSemaphores.push_back(vlk->device->createSemaphoreUnique({}));
+        }
     }
 
-    void createFramesInFlight() {
+    void createFramesInFlight(uint32_t count) {
         frameCommandPool = vlk->device->createCommandPoolUnique({
             .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
             .queueFamilyIndex = vlk->props.graphicsQueueFamily,
         });
 
+        framesInFlight.resize(count);
         for (auto& f : framesInFlight) {
             f = {
                 .commandBuffer = std::move(vlk->device->allocateCommandBuffersUnique({
@@ -179,16 +187,11 @@ private:
                     .commandBufferCount = 1,
                 })[0]),
                 .imageAvailableSemaphore = vlk->device->createSemaphoreUnique({}),
-                .renderFinishedSemaphore = vlk->device->createSemaphoreUnique({}),
-                .inFlightFence = vlk->device->createFenceUnique({
-                    .flags = vk::FenceCreateFlagBits::eSignaled,
-                }),
             };
         }
     }
 
     void recreateSwapchain() {
-        vlk->device->waitIdle();
         createSwapchain();
         if (onRecreateSwapchain) {
             onRecreateSwapchain();
@@ -200,36 +203,69 @@ private:
 public:
 
 public:
-    explicit WindowRenderTarget(const GraphicsContext* vlk, const WindowSurface* window)
-        : vlk(vlk), windowSurface(window)
+    // framesInFlight: how many frames the CPU may record ahead of the GPU, usually 2 or 3.
+    // presentMode: eFifo caps the frame rate to the display, eMailbox and eImmediate don't;
+    // falls back to eFifo when unsupported.
+    explicit WindowRenderTarget(
+        const GraphicsContext* vlk,
+        const WindowSurface* window,
+        uint32_t framesInFlight = 2,
+        vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo
+    ) : vlk(vlk), windowSurface(window), preferredPresentMode(presentMode), pacer(vlk, framesInFlight)
     {
+        assert(framesInFlight >= 1);
+        updateFramebufferSize();
         createSwapchain();
-        createFramesInFlight();
+        createFramesInFlight(framesInFlight);
     }
 
     std::function<void()> onRecreateSwapchain;
 
+    // Main thread only, call after glfwPollEvents(). The only member that may be called while another thread renders
+    void updateFramebufferSize() {
+        int w, h;
+        glfwGetFramebufferSize(windowSurface->window.get(), &w, &h);
+        framebufferSize.store({(uint32_t) w, (uint32_t) h}, std::memory_order_relaxed);
+    }
+    // Call pacer.wait() before sampling input to enable pacing, see FramePacer
+    FramePacer pacer;
+
+    vk::PresentModeKHR presentMode() const { return swapchain.info.presentMode; }
+    void setPresentMode(vk::PresentModeKHR mode) {
+        preferredPresentMode = mode;
+        recreateSwapchain();
+    }
+
+    // Per-frame resources of users are indexed by Frame::frameIndex, which is less than this
+    uint32_t framesInFlightCount() const { return framesInFlight.size(); }
+
     RenderTarget renderTarget() const {
         return {
             .extent = swapchain.info.imageExtent,
             .format = swapchain.info.imageFormat,
+            .images = swapchain.images,
             .imageViews = swapchain.imageViews,
+            .usage = swapchain.info.imageUsage,
+            .finalLayout = vk::ImageLayout::ePresentSrcKHR,
         };
     }
 
     [[nodiscard]]
     std::optional<Frame> startFrame() {
         try {
-            static_assert(maxFramesInFlight == 1);
-            const uint32_t frameIndex = 0;
+            const uint32_t frameIndex = frameNumber % framesInFlight.size();
             const auto& frameResources = framesInFlight[frameIndex];
-            (void) vlk->device->waitForFences(frameResources.inFlightFence.get(), VK_TRUE, -1);
+            pacer.beginWait();
+            // Waits for the frame that used this slot, framesInFlight frames ago
+            vlk->graphicsTimeline->wait(frameResources.timelineValue);
+            frameNumber++;
+            vlk->deletionQueue->collect();
             const uint32_t imageIndex = vlk->device->acquireNextImageKHR(swapchain.swapchain.get(), -1, frameResources.imageAvailableSemaphore.get(), nullptr).value;
             // vkAcquireNextImageKHR may return vk::Result::eSuboptimalKHR.
             // This is not an error, which means that
             // imageAvailableSemaphore was signaled,
             // so we can't return early without waiting on it
-            vlk->device->resetFences(frameResources.inFlightFence.get());
+            pacer.frameStarted(frameIndex);
             return activeFrame = Frame {
                 .commandBuffer = frameResources.commandBuffer.get(),
                 .frameIndex = frameIndex,
@@ -242,22 +278,28 @@ public:
         return std::nullopt;
     }
 
-    void endFrame() {
+    // Returns the graphics timeline value of the frame's submission
+    uint64_t endFrame() {
         assert(activeFrame.has_value());
+        auto& frameResources = framesInFlight[activeFrame->frameIndex];
         try {
-            const auto& frameResources = framesInFlight[activeFrame->frameIndex];
-            vlk->graphicsQueue.submit(vk::SubmitInfo {
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores = &frameResources.imageAvailableSemaphore.get(),
-                .pWaitDstStageMask = std::to_array<vk::PipelineStageFlags>({ vk::PipelineStageFlagBits::eColorAttachmentOutput }).data(),
-                .commandBufferCount = 1,
-                .pCommandBuffers = &frameResources.commandBuffer.get(),
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores = &frameResources.renderFinishedSemaphore.get(),
-            }, frameResources.inFlightFence.get());
+            const vk::Semaphore renderFinishedSemaphore = swapchain.renderFinishedSemaphores[activeFrame->imageIndex].get();
+            // Uploads recorded during this frame must run before it
+            vlk->uploads->flush();
+            const auto commandBuffers = pacer.submittedCommandBuffers(activeFrame->frameIndex, frameResources.commandBuffer.get());
+            const auto waits = std::to_array<QueueTimeline::Wait>({{
+                .semaphore = frameResources.imageAvailableSemaphore.get(),
+                .value = 0,
+                // The image may also be written by transfers, e.g. an upscaling blit
+                .stage = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer,
+            }});
+            // Presentation can't wait on timeline semaphores, so it still gets a binary one
+            frameResources.timelineValue = vlk->graphicsTimeline->submit(commandBuffers, waits, std::span(&renderFinishedSemaphore, 1));
+            vlk->deletionQueue->submitted(frameResources.timelineValue);
+            pacer.frameSubmitted(activeFrame->frameIndex, frameResources.timelineValue);
             const vk::Result presentRes = vlk->presentQueue.presentKHR(vk::PresentInfoKHR {
                 .waitSemaphoreCount = 1,
-                .pWaitSemaphores = &frameResources.renderFinishedSemaphore.get(),
+                .pWaitSemaphores = &renderFinishedSemaphore,
                 .swapchainCount = 1,
                 .pSwapchains = &swapchain.swapchain.get(),
                 .pImageIndices = &activeFrame->imageIndex,
@@ -271,5 +313,6 @@ public:
             recreateSwapchain();
         }
         activeFrame = std::nullopt;
+        return frameResources.timelineValue;
     }
 };
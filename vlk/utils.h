@@ -19,10 +19,14 @@ struct Frame {
     vk::CommandBuffer commandBuffer;
     uint32_t frameIndex;
     uint32_t imageIndex;
+    uint32_t viewCount = 1; // Images rendered by this frame, starting at imageIndex
 };
 
 struct RenderTarget {
     vk::Extent2D extent;
     vk::Format format;
+    std::span<const vk::Image> images;
     std::span<const vk::ImageView> imageViews;
+    vk::ImageUsageFlags usage;
+    vk::ImageLayout finalLayout; // Layout images must be left in at the end of a frame
 };